@@ -4,20 +4,15 @@
 #include "../eNET-AIO16-16F.h"
 #include "../adc.h"
 
-extern int apci;
-
-TADC_BaseClock::TADC_BaseClock(TBytes buf)
+TADC_BaseClock::TADC_BaseClock(TBytesView buf)
 {
 	this->setDId(ADC_BaseClock);
-	GUARD((buf.size() == 0) || (buf.size() == 4), ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH, 0);
+	require((buf.size() == 0) || (buf.size() == 4), ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH);
 }
 
-TBytes TADC_BaseClock::calcPayload(bool bAsReply)
+void TADC_BaseClock::writePayload(TPayloadWriter &out, bool bAsReply)
 {
-	TBytes bytes;
-	stuff(bytes, this->baseClock);
-	Trace("TADC_BaseClock::calcPayload built: ", bytes);
-	return bytes;
+	out.put(this->baseClock);
 };
 
 TADC_BaseClock &TADC_BaseClock::Go()
@@ -40,51 +35,50 @@ std::string TADC_BaseClock::AsString(bool bAsReply)
 	return dest.str();
 }
 
-TADC_StreamStart::TADC_StreamStart(TBytes buf)
+TADC_StreamStart::TADC_StreamStart(TBytesView buf)
 {
 	this->setDId(ADC_StreamStart);
-	GUARD((buf.size() == 0) || (buf.size() == 4), ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH, 0);
+	if (!require((buf.size() == 0) || (buf.size() == 4) || (buf.size() == 5) || (buf.size() == 7), ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH))
+		return;
 
-	if (buf.size() == 4)
+	if (buf.size() >= 4)
+		this->argConnectionID = (int)*(__u32 *)buf.data();
+	if (buf.size() >= 5)
 	{
-		if (-1 == AdcStreamingConnection)
-		{
-			this->argConnectionID = (int)*(__u32 *)buf.data();
-			AdcStreamingConnection = this->argConnectionID;
-		}
-		else
-		{
-			Error("ADC Busy");
-			throw std::logic_error("ADC Busy already, on Connection: "+std::to_string(AdcStreamingConnection));
-		}
+		if (!require(buf[4] <= lagDisconnect, ERR_DId_BAD_PARAM))
+			return;
+		this->argLagPolicy = (TAdcLagPolicy)buf[4];
 	}
-	Trace("AdcStreamingConnection: "+std::to_string(AdcStreamingConnection));
+	if (buf.size() >= 7)
+		this->argMaxLag = *(__u16 *)(buf.data() + 5);
+	Trace("ADC_StreamStart ConnectionID: " + std::to_string(this->argConnectionID));
 }
 
-TBytes TADC_StreamStart::calcPayload(bool bAsReply)
+void TADC_StreamStart::writePayload(TPayloadWriter &out, bool bAsReply)
 {
-	TBytes bytes;
-	stuff(bytes, this->argConnectionID);
-	Trace("TADC_StreamStart::calcPayload built: ", bytes);
-	return bytes;
+	out.put(this->argConnectionID);
 };
 
 TADC_StreamStart &TADC_StreamStart::Go()
 {
-	Trace("ADC_StreamStart::Go(), ADC Streaming Data will be sent on ConnectionID: "+std::to_string(AdcStreamingConnection));
-	auto status = apciDmaTransferSize(RING_BUFFER_SLOTS, BYTES_PER_TRANSFER);
-	if (status)
+	Trace("ADC_StreamStart::Go(), ADC Streaming Data will be sent on ConnectionID: "+std::to_string(this->argConnectionID));
+	if (this->argConnectionID == -1)
+		throw std::logic_error("ADC_StreamStart needs the ConnectionID to stream on");
+
+	auto status = apciCurrentBoard()->AdcStream->Subscribe(this->argConnectionID, this->argLagPolicy,
+											 this->argMaxLag ? this->argMaxLag : ADC_DEFAULT_MAX_LAG);
+	if (status == -EEXIST)
+		throw std::logic_error("ADC already streaming on Connection: " + std::to_string(this->argConnectionID));
+	if (status == -EBUSY)
 	{
-		Error("Error setting apciDmaTransferSize: "+std::to_string(status));
-		throw std::logic_error(err_msg[-status]);
+		Error("ADC Busy");
+		throw std::logic_error("ADC Busy: already streaming to " + std::to_string(ADC_MAX_SUBSCRIBERS) + " connections");
 	}
-
-	AdcStreamTerminate = 0;
-	if (AdcWorkerThreadID == -1)
+	if (status)
 	{
-		AdcWorkerThreadID = pthread_create(&worker_thread, NULL, &worker_main, &AdcStreamingConnection);
+		Error("Error starting ADC streaming: " + std::to_string(status));
+		throw std::logic_error(err_msg[-status]);
 	}
-	apciDmaStart();
 	return *this;
 };
 
@@ -100,27 +94,34 @@ std::string TADC_StreamStart::AsString(bool bAsReply)
 
 
 
-TADC_StreamStop::TADC_StreamStop(TBytes buf)
+TADC_StreamStop::TADC_StreamStop(TBytesView buf)
 {
 	this->setDId(ADC_StreamStop);
-	GUARD(buf.size() == 0, ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH, 0);
+	if (!require((buf.size() == 0) || (buf.size() == 4), ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH))
+		return;
+	if (buf.size() == 4)
+		this->argConnectionID = (int)*(__u32 *)buf.data();
 }
 
-TBytes TADC_StreamStop::calcPayload(bool bAsReply)
+void TADC_StreamStop::writePayload(TPayloadWriter &out, bool bAsReply)
 {
-	TBytes bytes;
-	return bytes;
+	if (this->argConnectionID != -1)
+		out.put(this->argConnectionID);
 };
 
 TADC_StreamStop &TADC_StreamStop::Go()
 {
-	Trace("ADC_StreamStop::Go(): terminating ADC Streaming");
-	AdcStreamTerminate = 1;
-	apciCancelWaitForIRQ();
-	AdcStreamingConnection = -1;
-	AdcWorkerThreadID = -1;
-	// pthread_cancel(worker_thread);
-	// pthread_join(worker_thread, NULL);
+	if (this->argConnectionID == -1)
+	{
+		Trace("ADC_StreamStop::Go(): terminating ADC Streaming");
+		apciCurrentBoard()->AdcStream->Stop();
+	}
+	else
+	{
+		Trace("ADC_StreamStop::Go(): unsubscribing ConnectionID: " + std::to_string(this->argConnectionID));
+		if (apciCurrentBoard()->AdcStream->Unsubscribe(this->argConnectionID))
+			throw std::logic_error("ADC not streaming on Connection: " + std::to_string(this->argConnectionID));
+	}
 	Trace("ADC_StreamStop::Go() exiting");
 	return *this;
 };
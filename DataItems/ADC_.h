@@ -1,37 +1,42 @@
 #pragma once
 
 #include "TDataItem.h"
+#include "../adc.h"
 
-class TADC_BaseClock : public TDataItem
+class TADC_BaseClock final : public TDataItem
 {
 public:
 	TADC_BaseClock(){ setDId(ADC_BaseClock);}
-	TADC_BaseClock(TBytes buf);
-	virtual TBytes calcPayload(bool bAsReply=false);
+	TADC_BaseClock(TBytesView buf);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 	virtual TADC_BaseClock &Go();
 	virtual std::string AsString(bool bAsReply = false);
 protected:
 	__u32 baseClock = 25000000;
 };
 
-class TADC_StreamStart : public TDataItem
+class TADC_StreamStart final : public TDataItem
 {
 public:
-	TADC_StreamStart(TBytes buf);
+	TADC_StreamStart(TBytesView buf);
 	TADC_StreamStart(){ setDId(ADC_StreamStart);};
-	virtual TBytes calcPayload(bool bAsReply=false);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 	virtual TADC_StreamStart &Go();
 	virtual std::string AsString(bool bAsReply = false);
 protected:
 	int argConnectionID = -1;
+	TAdcLagPolicy argLagPolicy = lagDropOldest;
+	__u16 argMaxLag = 0; // blocks; 0 for ADC_DEFAULT_MAX_LAG
 };
 
-class TADC_StreamStop : public TDataItem
+class TADC_StreamStop final : public TDataItem
 {
 public:
 	TADC_StreamStop(){ setDId(ADC_StreamStop);}
-	TADC_StreamStop(TBytes buf);
-	virtual TBytes calcPayload(bool bAsReply=false);
+	TADC_StreamStop(TBytesView buf);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 	virtual TADC_StreamStop &Go();
 	virtual std::string AsString(bool bAsReply = false);
+protected:
+	int argConnectionID = -1; // -1 stops streaming to everyone
 };
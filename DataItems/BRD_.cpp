@@ -15,11 +15,9 @@ TBRD_FpgaID &TBRD_FpgaID::Go() {
 	this->fpgaID = in(ofsFpgaID);
 	return *this;
 }
-TBytes TBRD_FpgaID::calcPayload(bool bAsReply) {
-	TBytes bytes;
+void TBRD_FpgaID::writePayload(TPayloadWriter &out, bool bAsReply) {
 	if (bAsReply)
-		stuff<__u32>(bytes, this->fpgaID);
-	return bytes;
+		out.put<__u32>(this->fpgaID);
 }
 
 
@@ -33,11 +31,9 @@ TBRD_DeviceID &TBRD_DeviceID::Go() {
 	this->deviceID = in(ofsDeviceID) & 0xFFFF;
 	return *this;
 }
-TBytes TBRD_DeviceID::calcPayload(bool bAsReply) {
-	TBytes bytes;
+void TBRD_DeviceID::writePayload(TPayloadWriter &out, bool bAsReply) {
 	if (bAsReply)
-		stuff<__u16>(bytes, this->deviceID);
-	return bytes;
+		out.put<__u16>(this->deviceID);
 }
 
 
@@ -51,11 +47,38 @@ TBRD_Features &TBRD_Features::Go() {
 	this->features = in(ofsFeatures) & 0xFF;
 	return *this;
 }
-TBytes TBRD_Features::calcPayload(bool bAsReply){
-	TBytes bytes;
+void TBRD_Features::writePayload(TPayloadWriter &out, bool bAsReply) {
 	if (bAsReply)
-		stuff<__u32>(bytes, this->features);
-	return bytes;
+		out.put<__u32>(this->features);
 }
 
+
+TBRD_Select::TBRD_Select(TBytesView buf) {
+	this->setDId(BRD_Select);
+	if (!require(buf.size() <= 1, ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH))
+		return;
+	if (buf.size() == 1)
+		this->argBoard = buf[0];
+}
+std::string TBRD_Select::AsString(bool bAsReply) {
+	std::string args = (this->argBoard < 0) ? "" : std::to_string(this->argBoard);
+	if (bAsReply)
+		return "BRD_Select(" + args + ") → board " + std::to_string(this->board) + " of " + std::to_string(this->boards);
+	else
+		return "BRD_Select(" + args + ")";
+}
+TBRD_Select &TBRD_Select::Go() {
+	this->board = apciCurrentBoard()->Index;
+	this->boards = apciBoardCount();
+	return *this;
+}
+void TBRD_Select::writePayload(TPayloadWriter &out, bool bAsReply) {
+	if (bAsReply)
+	{
+		out.put<__u8>(this->board);
+		out.put<__u8>(this->boards);
+	}
+	else if (this->argBoard >= 0)
+		out.put<__u8>(this->argBoard);
+}
 #pragma endregion
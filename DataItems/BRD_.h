@@ -1,32 +1,54 @@
 #pragma once
 #include "TDataItem.h"
 
-class TBRD_FpgaID : public TDataItem {
+class TBRD_FpgaID final : public TDataItem {
 public:
 	TBRD_FpgaID(){ setDId(BRD_FpgaID); }
 	virtual std::string AsString(bool bAsReply = false);
 	virtual TBRD_FpgaID &Go();
-	virtual TBytes calcPayload(bool bAsReply=false);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 protected:
 	__u32 fpgaID = 0x00010005;
 };
 
-class TBRD_DeviceID : public TDataItem {
+class TBRD_DeviceID final : public TDataItem {
 public:
 	TBRD_DeviceID(){ setDId(BRD_DeviceID); }
 	virtual std::string AsString(bool bAsReply = false);
 	virtual TBRD_DeviceID &Go();
-	virtual TBytes calcPayload(bool bAsReply=false);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 protected:
 	__u16 deviceID = 0;
 };
 
-class TBRD_Features : public TDataItem {
+class TBRD_Features final : public TDataItem {
 public:
 	TBRD_Features(){ setDId(BRD_Features); }
 	virtual std::string AsString(bool bAsReply = false);
 	virtual TBRD_Features &Go();
-	virtual TBytes calcPayload(bool bAsReply=false);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 protected:
 	__u8 features = 0;
+};
+
+/*
+	BRD_Select(board) makes board (0 .. boards-1) the one this Message, and the connection's later Messages, run on;
+	BRD_Select() just asks.  Either way the Reply is the board the Message ran on and how many the server has.
+	aioenetd acts on the selection as it queues the Message, before anything runs (see SelectBoard()); .Go() only
+	reports it.
+*/
+class TBRD_Select final : public TDataItem {
+public:
+	TBRD_Select(){ setDId(BRD_Select); }
+	TBRD_Select(TBytesView buf);
+	virtual std::string AsString(bool bAsReply = false);
+	virtual TBRD_Select &Go();
+	virtual TResourceMask getResources() { return 0; }
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
+	// the board asked for, or -1 for a query
+	int getBoard() { return argBoard; }
+protected:
+	int argBoard = -1;
+	__u8 board = 0;
+	__u8 boards = 0;
 };
\ No newline at end of file
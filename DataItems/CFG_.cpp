@@ -4,9 +4,11 @@
 
 #include "CFG_.h"
 
-TCFG_Hostname::TCFG_Hostname(TBytes buf)
+TCFG_Hostname::TCFG_Hostname(TBytesView buf)
 {
-	if (buf.size() >= 64) throw std::logic_error("invalid hostname");
+	this->setDId(CFG_Hostname);
+	if (!require(buf.size() < 64, ERR_DId_BAD_PARAM)) // invalid hostname
+		return;
 	std::string name(buf.begin(), buf.end());
 
 	// if > 0
@@ -15,11 +17,9 @@ TCFG_Hostname::TCFG_Hostname(TBytes buf)
 	// 	save to this->hostname
 }
 
-TBytes TCFG_Hostname::calcPayload(bool bAsReply)
+void TCFG_Hostname::writePayload(TPayloadWriter &out, bool bAsReply)
 {
-	TBytes bytes;
-	stuff(bytes, this->hostname);
-	return bytes;
+	out.put(this->hostname);
 }
 
 std::string TCFG_Hostname::AsString(bool bAsReply)
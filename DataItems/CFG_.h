@@ -3,12 +3,12 @@
 #include "../config.h"
 #include "TDataItem.h"
 
-class TCFG_Hostname : public TDataItem
+class TCFG_Hostname final : public TDataItem
 {
 public:
-	TCFG_Hostname(TBytes buf);
+	TCFG_Hostname(TBytesView buf);
 	TCFG_Hostname(){ setDId(CFG_Hostname); }
-	virtual TBytes calcPayload(bool bAsReply=false);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 	virtual std::string AsString(bool bAsReply = false);
 	virtual TCFG_Hostname &Go();
 protected:
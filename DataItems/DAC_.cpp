@@ -5,21 +5,22 @@
 #include "TDataItem.h"
 #include "DAC_.h"
 
-TDAC_Output::TDAC_Output(TBytes bytes)
+TDAC_Output::TDAC_Output(TBytesView bytes)
 {
 	Debug("Received: ", bytes);
 	setDId(DAC_Output1);
 	TError result = ERR_SUCCESS;
 	this->Data = bytes;
 
-	if (bytes.size() >= 1)
+	if (this->Data.size() >= 1)
 	{
-		GUARD(this->Data[0] < 4, ERR_DId_BAD_PARAM, this->Data[0]);
+		if (!require(this->Data[0] < 4, ERR_DId_BAD_PARAM))
+			return;
 		this->dacChannel = this->Data[0];
 		this->dacCounts = 0x0000;
 		this->bWrite = false;
 	}
-	if (bytes.size() == 3)
+	if (this->Data.size() == 3)
 	{
 		__u16 counts = this->Data[1] | this->Data[2] << 8;
 		this->bWrite = true;
@@ -29,12 +30,10 @@ TDAC_Output::TDAC_Output(TBytes bytes)
 	return;
 }
 
-TBytes TDAC_Output::calcPayload(bool bAsReply)
+void TDAC_Output::writePayload(TPayloadWriter &out, bool bAsReply)
 {
-	TBytes bytes;
-	stuff<__u8>(bytes, this->dacChannel);
-	stuff<__u16>(bytes, this->dacCounts);
-	return bytes;
+	out.put<__u8>(this->dacChannel);
+	out.put<__u16>(this->dacCounts);
 }
 
 std::string TDAC_Output::AsString(bool bAsReply)
@@ -50,21 +49,22 @@ TDAC_Output & TDAC_Output::Go()
 	return *this;
 }
 
-TDAC_Range1::TDAC_Range1(TBytes bytes)
+TDAC_Range1::TDAC_Range1(TBytesView bytes)
 {
 	Debug("Received: ", bytes);
 	setDId(DAC_Range1);
 	TError result = ERR_SUCCESS;
 	this->Data = bytes;
 
-	if (bytes.size() >= 1)
+	if (this->Data.size() >= 1)
 	{
-		GUARD(this->Data[0] < 4, ERR_DId_BAD_PARAM, this->Data[0]);
+		if (!require(this->Data[0] < 4, ERR_DId_BAD_PARAM))
+			return;
 		this->dacChannel = this->Data[0];
 		this->dacRange = 0xFFFFFFFF;
 		this->bWrite = false;
 	}
-	if (bytes.size() == 5)
+	if (this->Data.size() == 5)
 	{
 		__u32 rangeCode = this->Data[1] | this->Data[2] << 8 | this->Data[3] << 16 | this->Data[4] << 24;
 		if((rangeCode < 4)
@@ -81,12 +81,10 @@ TDAC_Range1::TDAC_Range1(TBytes bytes)
 	return;
 }
 
-TBytes TDAC_Range1::calcPayload(bool bAsReply)
+void TDAC_Range1::writePayload(TPayloadWriter &out, bool bAsReply)
 {
-	TBytes bytes;
-	stuff<__u8>(bytes, this->dacChannel);
-	stuff<__u32>(bytes, this->dacRange);
-	return bytes;
+	out.put<__u8>(this->dacChannel);
+	out.put<__u32>(this->dacRange);
 };
 
 TDAC_Range1 &TDAC_Range1::Go()
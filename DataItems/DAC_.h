@@ -3,11 +3,11 @@
 #include "TDataItem.h"
 #include "../eNET-types.h"
 
-class TDAC_Output : public TDataItem
+class TDAC_Output final : public TDataItem
 {
 public:
-	TDAC_Output(TBytes buf);
-	virtual TBytes calcPayload(bool bAsReply=false);
+	TDAC_Output(TBytesView buf);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 	virtual std::string AsString(bool bAsReply = false);
 	virtual TDAC_Output &Go();
 protected:
@@ -17,12 +17,12 @@ protected:
 
 
 
-class TDAC_Range1 : public TDataItem
+class TDAC_Range1 final : public TDataItem
 {
 public:
-	TDAC_Range1(TBytes buf);
+	TDAC_Range1(TBytesView buf);
 	TDAC_Range1(){ setDId(DAC_Range1);};
-	virtual TBytes calcPayload(bool bAsReply=false);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 	virtual std::string AsString(bool bAsReply = false);
 	virtual TDAC_Range1 &Go();
 protected:
@@ -23,7 +23,7 @@ std::shared_ptr<void> TREG_Read1::getResultValue()
 			   : (std::shared_ptr<void>)std::shared_ptr<__u32>(new __u32(this->Value));
 }
 
-TError TREG_Read1::validateDataItemPayload(DataItemIds DataItemID, TBytes Data)
+TError TREG_Read1::validateDataItemPayload(DataItemIds DataItemID, TBytesView Data)
 {
 	TError result = ERR_SUCCESS;
 	if (Data.size() != 1)
@@ -54,15 +54,17 @@ TREG_Read1::TREG_Read1()
 	this->setDId(REG_Read1);
 }
 
-TREG_Read1::TREG_Read1(TBytes data)
+TREG_Read1::TREG_Read1(TBytesView data)
 {
 	Trace("ENTER. TBytes: ", data);
 	this->setDId(REG_Read1);
 
-	GUARD(data.size() == 1, ERR_DId_BAD_PARAM, data.size());
+	if (!require(data.size() == 1, ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH))
+		return;
+	int w = widthFromOffset(data[0]);
+	if (!require(w != 0, ERR_DId_BAD_OFFSET))
+		return;
 	this->offset = data[0];
-	int w = widthFromOffset(offset);
-	GUARD(w != 0, ERR_DId_BAD_PARAM, REG_Read1);
 	this->width = w;
 }
 
@@ -79,30 +81,6 @@ TREG_Read1 &TREG_Read1::setOffset(int ofs)
 	return *this;
 }
 
-TBytes TREG_Read1::calcPayload(bool bAsReply)
-{
-	TBytes bytes;
-	stuff<__u8>(bytes, this->offset);
-
-	if (bAsReply)
-	{
-		auto value = this->getResultValue();
-		__u32 v = *((__u32 *)value.get());
-
-		if (this->width == 8)
-		{
-			stuff<__u8>(bytes, v&0xFF);
-		}
-		else
-		{
-			stuff<__u32>(bytes, v);
-		}
-	}
-
-	Trace("TREG_Read1::calcPayload built: ", bytes);
-	return bytes;
-}
-
 std::string TREG_Read1::AsString(bool bAsReply)
 {
 	std::stringstream dest;
@@ -111,15 +89,14 @@ std::string TREG_Read1::AsString(bool bAsReply)
 	if (bAsReply)
 	{
 		dest << " → ";
-		auto value = this->getResultValue();
-		__u32 v = *((__u32 *)value.get());
+		// Value directly, as writePayload() does; this runs for every logged Reply
 		if (this->width == 8)
 		{
-			dest << std::hex << std::setw(2) << (v & 0x000000FF);
+			dest << std::hex << std::setw(2) << (this->Value & 0x000000FF);
 		}
 		else
 		{
-			dest << std::hex << std::setw(8) << v;
+			dest << std::hex << std::setw(8) << this->Value;
 		}
 	}
 	Trace("Built: " + dest.str());
@@ -128,12 +105,6 @@ std::string TREG_Read1::AsString(bool bAsReply)
 #pragma endregion
 
 #pragma region TREG_Writes implementation
-TREG_Writes::~TREG_Writes()
-{
-	Trace("Attempting to free the memory in this->Writes vector");
-	this->Writes.clear();
-}
-
 // TODO: write WaitUntilBitsMatch(__u8 offset, __u32 bmMask, __u32 bmPattern);
 int WaitUntilRegisterBitIsLow(__u8 offset, __u32 bitMask) // TODO: move into utility source file
 {
@@ -176,6 +147,14 @@ __s64 now() // in nanoseconds
 	return Now.tv_sec * 1E9 + Now.tv_nsec;
 }
 
+TResourceMask TREG_Writes::getResources()
+{
+	TResourceMask resources = 0;
+	for (auto action : this->Writes)
+		resources |= resourcesFromOffset(action.offset);
+	return resources;
+}
+
 TREG_Writes &TREG_Writes::Go()
 {
 	static __s64 nextAllowedTimeDioSpi = now(), nextAllowedTimeDacSpi = now();
@@ -225,19 +204,18 @@ TREG_Write1::TREG_Write1()
 {
 	this->setDId(REG_Write1);
 }
-TREG_Write1::~TREG_Write1()
-{
-	this->Writes.clear();
-}
 
-TREG_Write1::TREG_Write1(TBytes buf)
+TREG_Write1::TREG_Write1(TBytesView buf)
 {
 	this->setDId(REG_Write1);
-	GUARD(buf.size() > 0, ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH, 0);
+	if (!require(buf.size() > 0, ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH))
+		return;
 	__u8 ofs = buf[0];
 	int w = widthFromOffset(ofs);
-	GUARD(w != 0, ERR_DId_BAD_OFFSET, ofs);
-	GUARD(w == 8 ? (buf.size() == 2) : (buf.size() == 5), ERR_DId_BAD_PARAM, buf.size());
+	if (!require(w != 0, ERR_DId_BAD_OFFSET))
+		return;
+	if (!require(w == 8 ? (buf.size() == 2) : (buf.size() == 5), ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH))
+		return;
 
 	__u32 value = 0;
 	if (w == 8)
@@ -248,19 +226,19 @@ TREG_Write1::TREG_Write1(TBytes buf)
 	this->addWrite(w, ofs, value);
 }
 
-TBytes TREG_Write1::calcPayload(bool bAsReply)
+void TREG_Write1::writePayload(TPayloadWriter &out, bool bAsReply)
 {
-	TBytes bytes;
-	if (this->Writes.size() > 0)
-		stuff<__u8>(bytes, this->Writes[0].offset);
-	else
+	if (this->Writes.size() == 0)
+	{
 		Error("ERROR: nothing in Write[] queue");
+		return;
+	}
+	out.put<__u8>(this->Writes[0].offset);
 
 	__u32 v = this->Writes[0].value;
 	for (int i = 0; i < this->Writes[0].width / 8; i++)
 	{
-		bytes.push_back(v & 0x000000FF);
+		out.put<__u8>(v & 0x000000FF);
 		v >>= 8;
 	}
-	return bytes;
 }
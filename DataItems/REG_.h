@@ -3,16 +3,30 @@
 #include "TDataItem.h"
 
 #pragma region "class TREG_Read1 : TDataItem" for DataItemIds::REG_Read1 "Read Register Value"
-class TREG_Read1 : public TDataItem
+class TREG_Read1 final : public TDataItem
 {
 public:
-	static TError validateDataItemPayload(DataItemIds DataItemID, TBytes Data);
-	TREG_Read1(TBytes data);
+	static TError validateDataItemPayload(DataItemIds DataItemID, TBytesView Data);
+	TREG_Read1(TBytesView data);
 	TREG_Read1();
 	TREG_Read1(DataItemIds DId, int ofs);
 	TREG_Read1 &setOffset(int ofs);
-	virtual TBytes calcPayload(bool bAsReply=false);
+	// inline, as it runs twice per reply: in a TPayload, sizing a 16-REG_Read1 reply then folds down to arithmetic
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false)
+	{
+		out.put<__u8>(this->offset);
+
+		// read Value directly; getResultValue() heap-allocates
+		if (bAsReply)
+		{
+			if (this->width == 8)
+				out.put<__u8>(this->Value & 0xFF);
+			else
+				out.put<__u32>(this->Value);
+		}
+	}
 	virtual TREG_Read1 &Go();
+	virtual TResourceMask getResources() { return resourcesFromOffset(offset); }
 	virtual std::shared_ptr<void> getResultValue(); // TODO: fix; think this through
 	virtual std::string AsString(bool bAsReply = false);
 	int offset{0};
@@ -28,9 +42,9 @@ class TREG_Writes : public TDataItem
 {
 	public:
 		TREG_Writes() = default;
-		~TREG_Writes();
-		TREG_Writes(TBytes buf);
+		TREG_Writes(TBytesView buf);
 		virtual TREG_Writes &Go();
+		virtual TResourceMask getResources();
 		TREG_Writes &addWrite(__u8 w, int ofs, __u32 value);
 		virtual std::string AsString(bool bAsReply);
 
@@ -40,14 +54,13 @@ class TREG_Writes : public TDataItem
 #pragma endregion
 
 #pragma region "class TREG_Write1 : TREG_Writes" for REG_Write1 "Write Register Value"
-class TREG_Write1 : public TREG_Writes
+class TREG_Write1 final : public TREG_Writes
 {
 public:
-	static TError validateDataItemPayload(DataItemIds DataItemID, TBytes Data);
+	static TError validateDataItemPayload(DataItemIds DataItemID, TBytesView Data);
 	TREG_Write1();
-	~TREG_Write1();
-	TREG_Write1(TBytes buf);
-	virtual TBytes calcPayload(bool bAsReply=false);
+	TREG_Write1(TBytesView buf);
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply=false);
 	//virtual std::string AsString(bool bAsReply=false);
 };
 #pragma endregion
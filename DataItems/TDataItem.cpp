@@ -6,20 +6,20 @@
 #include "CFG_.h"
 #include "DAC_.h"
 #include "REG_.h"
+#include "TPayload.h"
 #include "../eNET-AIO16-16F.h"
 
-extern int apci;
-
 #define DIdNYI(d)	{d, 0, 0, 0, construct<TDataItemNYI>, #d " (NYI)"}
 
 // DId Enum, minLen,tarLen,maxLen,class-constructor,human-readable-doc
-TDIdListEntry const DIdList[] = {
+constexpr TDIdListEntry DIdList[] = {
 	{INVALID, 0, 0, 0, construct<TDataItem>, "Invalid DId"},
 	{BRD_, 0, 0, 255, construct<TDataItem>, "TDataItem Base (BRD_)"},
 	{BRD_Reset, 0, 0, 0, construct<TDataItem>, "BRD_Reset(void)"},
 	{BRD_DeviceID, 0, 4, 255, construct<TDataItem>, "BRD_DeviceID() → u16"},
 	{BRD_Features, 0, 4, 255, construct<TDataItem>, "BRD_Features() → u8"},
 	{BRD_FpgaID, 0, 4, 255, construct<TDataItem>, "BRD_FpgaID() → u32"},
+	{BRD_Select, 0, 1, 1, construct<TBRD_Select>, "BRD_Select([u8 board]) → u8 board, u8 boards"},
 
 	{REG_Read1, 1, 1, 1, construct<TREG_Read1>, "REG_Read1(u8 offset) → [u8|u32]"},
 	DIdNYI(REG_ReadAll),
@@ -117,8 +117,8 @@ TDIdListEntry const DIdList[] = {
 	DIdNYI(ADC_RawAll),
 	DIdNYI(ADC_RawSome),
 
-	{ADC_StreamStart, 4, 4, 4, construct<TADC_StreamStart>, "ADC_StreamStart((u32)AdcConnectionId)"},
-	{ADC_StreamStop, 0, 0, 0, construct<TADC_StreamStop>, "ADC_StreamStop()"},
+	{ADC_StreamStart, 4, 4, 7, construct<TADC_StreamStart>, "ADC_StreamStart((u32)AdcConnectionId[, (u8)LagPolicy[, (u16)MaxLagBlocks]])"},
+	{ADC_StreamStop, 0, 0, 4, construct<TADC_StreamStop>, "ADC_StreamStop([(u32)AdcConnectionId])"},
 
 	DIdNYI(ADC_Streaming_stuff_including_Hz_config),
 
@@ -138,6 +138,62 @@ TDIdListEntry const DIdList[] = {
 	//		perhaps make a TDataItem derivative that is hard-coded NYI
 };
 
+#pragma region DIdList index
+/*	DIdList[] is indexed at compile time so that looking up a DId costs two table reads and one compare, not a walk
+	of the whole list.  DIds are grouped by their high byte (BRD_, REG_, DAC_, ...); DIdGroupSlot[] maps a high byte
+	to a row of DIdIndex[], and the row is indexed by the low byte modulo DID_GROUP_WIDTH.  Every DId in the same
+	group must land in its own column: the build fails (static_assert) if a new DId collides, in which case widen
+	DID_GROUP_WIDTH.  Lookups confirm the DId stored in the entry, so unknown DIds that alias a column are rejected.
+*/
+#define DID_GROUP_WIDTH 64
+
+constexpr int DIdListCount = sizeof(DIdList) / sizeof(TDIdListEntry);
+
+constexpr int countDIdGroups()
+{
+	int count = 0;
+	for (int i = 0; i < DIdListCount; i++)
+	{
+		bool seen = false;
+		for (int j = 0; j < i; j++)
+			seen |= (DIdList[j].DId >> 8) == (DIdList[i].DId >> 8);
+		count += !seen;
+	}
+	return count;
+}
+constexpr int DIdGroupCount = countDIdGroups();
+
+struct TDIdIndex
+{
+	__u8 GroupSlot[256];								// DId high byte -> 1 + row in Entry[]; 0 if no DIds in that group
+	__s16 Entry[DIdGroupCount][DID_GROUP_WIDTH];	// DIdList[] index, or -1
+	bool bValid;									// false if two DIds collided
+};
+
+constexpr TDIdIndex buildDIdIndex()
+{
+	TDIdIndex index{};
+	index.bValid = true;
+	int groups = 0;
+	for (int row = 0; row < DIdGroupCount; row++)
+		for (int col = 0; col < DID_GROUP_WIDTH; col++)
+			index.Entry[row][col] = -1;
+	for (int i = 0; i < DIdListCount; i++)
+	{
+		__u8 group = DIdList[i].DId >> 8;
+		if (index.GroupSlot[group] == 0)
+			index.GroupSlot[group] = ++groups;
+		__s16 &slot = index.Entry[index.GroupSlot[group] - 1][(DIdList[i].DId & 0xFF) % DID_GROUP_WIDTH];
+		if (slot != -1)
+			index.bValid = false;
+		slot = i;
+	}
+	return index;
+}
+constexpr TDIdIndex DIdIndex = buildDIdIndex();
+static_assert(DIdIndex.bValid, "two DIdList[] entries share a DIdIndex slot; duplicate DId, or widen DID_GROUP_WIDTH");
+#pragma endregion
+
 // crap function returns 8 or 32 for valid offsets into eNET-AIO's register map, or 0 for invalid
 // specific to eNET-AIO register map
 int widthFromOffset(int ofs)
@@ -149,6 +205,22 @@ int widthFromOffset(int ofs)
     return 0;
 }
 
+// also specific to eNET-AIO register map
+TResourceMask resourcesFromOffset(int ofs)
+{
+	if (ofs == ofsReset)
+		return resAll;
+	if (ofs < ofsDac)
+		return resAdc;
+	if (ofs < ofsDioDirections)
+		return resDac;
+	if (ofs <= ofsDioInputs)
+		return resDio;
+	if ((ofs >= ofsAdcBaseClock) && (ofs <= ofsAdcCalOffset4))
+		return resAdc;
+	return resBoard;
+}
+
 #pragma region TDataItem implementation
 /*	TDataItem
 	Base Class, provides basics for handling TDataItem payloads.
@@ -171,14 +243,17 @@ int widthFromOffset(int ofs)
 // NOTE:
 //   This should be implemented OOP-style: each TDataItem ID should be a descendant-class that provides the
 //   specific validate and parse appropriate to that DataItemID
-int TDataItem::validateDataItemPayload(DataItemIds DId, TBytes Data)
+int TDataItem::validateDataItemPayload(DataItemIds DId, TBytesView Data)
 {
 	Trace("ENTER, DId: "+ to_hex<TDataId>(DId)+": ", Data);
 	int result = ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH;
 	int index = TDataItem::getDIdIndex(DId);
+	if (index < 0)
+		return ERR_MSG_DATAITEM_ID_UNKNOWN;
+	const TDIdListEntry &entry = DIdList[index];
 	TDataItemLength len = Data.size();
-	Trace(std::to_string(getMinLength(DId)) + " <= " + std::to_string(len) + " <= " + std::to_string(getMaxLength(DId)));
-	if ((TDataItem::getMinLength(DId) <= len) && (len <= TDataItem::getMaxLength(DId)))
+	Trace(std::to_string(entry.minLen) + " <= " + std::to_string(len) + " <= " + std::to_string(entry.maxLen));
+	if ((entry.minLen <= len) && (len <= entry.maxLen))
 	{
 		result = ERR_SUCCESS;
 		Trace("Valid");
@@ -190,34 +265,39 @@ int TDataItem::validateDataItemPayload(DataItemIds DId, TBytes Data)
 
 int TDataItem::getDIdIndex(DataItemIds DId)
 {
-	int count = sizeof(DIdList) / sizeof(TDIdListEntry);
-	for (int index = 0; index < count; index++)
-	{
-		if (DId == DIdList[index].DId){
-			return index;
-	}}
-	throw std::logic_error("DId not found in list");
+	__u8 row = DIdIndex.GroupSlot[DId >> 8];
+	if (row == 0)
+		return -1;
+	int index = DIdIndex.Entry[row - 1][(DId & 0xFF) % DID_GROUP_WIDTH];
+	if ((index < 0) || (DIdList[index].DId != DId))
+		return -1;
+	return index;
 }
 
 // returns human-readable description of this TDataItem
 std::string TDataItem::getDIdDesc(DataItemIds DId)
 {
-	return std::string(DIdList[TDataItem::getDIdIndex(DId)].desc);
+	int index = TDataItem::getDIdIndex(DId);
+	return (index < 0) ? "Unknown DId " + to_hex<TDataId>(DId) : DIdList[index].desc;
 }
 
+// the length getters return 0 for unknown DIds, which validateDataItemPayload() never reaches
 TDataItemLength TDataItem::getMinLength(DataItemIds DId)
 {
-	return DIdList[getDIdIndex(DId)].minLen;
+	int index = getDIdIndex(DId);
+	return (index < 0) ? 0 : DIdList[index].minLen;
 }
 
 TDataItemLength TDataItem::getTargetLength(DataItemIds DId)
 {
-	return DIdList[getDIdIndex(DId)].expectedLen;
+	int index = getDIdIndex(DId);
+	return (index < 0) ? 0 : DIdList[index].expectedLen;
 }
 
 TDataItemLength TDataItem::getMaxLength(DataItemIds DId)
 {
-	return DIdList[getDIdIndex(DId)].maxLen;
+	int index = getDIdIndex(DId);
+	return (index < 0) ? 0 : DIdList[index].maxLen;
 }
 
 void TDataItem::pushDId(TBytes & buf)
@@ -232,19 +312,10 @@ void TDataItem::pushLen(TBytes & buf, TDataItemLength len)
 
 int TDataItem::isValidDataItemID(DataItemIds DataItemID)
 {
-	int result = false;
-	for (auto aDIdEntry : DIdList)
-	{
-		if (DataItemID == aDIdEntry.DId)
-		{
-			result = true;
-			break;
-		}
-	}
-	return result;
+	return getDIdIndex(DataItemID) >= 0;
 }
 
-int TDataItem::validateDataItem(TBytes msg)
+int TDataItem::validateDataItem(TBytesView msg)
 {
 	int result = 0;
 	if (msg.size() < sizeof(TDataItemHeader)){
@@ -257,57 +328,58 @@ int TDataItem::validateDataItem(TBytes msg)
 	DataItemIds Id = head->DId;
 	if (!isValidDataItemID(Id))
 	{
-		Error(err_msg[ERR_MSG_DATAITEM_ID_UNKNOWN]);
+		Error(err_msg[-ERR_MSG_DATAITEM_ID_UNKNOWN]);
 		return ERR_MSG_DATAITEM_ID_UNKNOWN;
 	}
 
 	if (DataItemSize == 0) // no data in this data item so no need to check the payload
 		return result;
 	else
-	{
-		TBytes Data = msg;
-		Data.erase(Data.cbegin(), Data.cbegin() + sizeof(TDataItemHeader));
-		result = validateDataItemPayload(Id, Data);
-	}
+		result = validateDataItemPayload(Id, msg.subspan(sizeof(TDataItemHeader)));
 
 	Trace("validateDataItem status: " + std::to_string(result) + ", " + err_msg[-result]);
 	return result;
 }
 
 // factory method
-PTDataItem TDataItem::fromBytes(TBytes msg, TError &result)
+TPayloadItem TDataItem::fromBytes(TBytesView msg, TError &result, std::pmr::memory_resource *arena)
 {
 	result = ERR_SUCCESS;
 	Debug("Received = ", msg);
 
-	GUARD((msg.size() >= sizeof(TDataItemHeader)), ERR_MSG_DATAITEM_TOO_SHORT, msg.size());
+	if (msg.size() < sizeof(TDataItemHeader))
+	{
+		result = ERR_MSG_DATAITEM_TOO_SHORT;
+		Error("TDataItem::fromBytes() DataItem is only " + std::to_string(msg.size()) + " bytes");
+		return TPayloadItem(PTDataItem());
+	}
 
 	TDataItemHeader *head = (TDataItemHeader *)msg.data();
-	GUARD(isValidDataItemID(head->DId), ERR_DId_INVALID, head->DId);
+	// one lookup serves validation, length limits and construction; unknown DIds are a result code, not an exception
+	int index = getDIdIndex(head->DId);
+	if (index < 0)
+	{
+		result = ERR_MSG_DATAITEM_ID_UNKNOWN;
+		Error("TDataItem::fromBytes() unknown DId " + to_hex<TDataId>(head->DId));
+		return TPayloadItem(PTDataItem());
+	}
+	const TDIdListEntry &entry = DIdList[index];
 
-	PTDataItem anItem;
 	TDataItemLength DataSize = head->dataLength; // MessageLength
-	TBytes data;
-	if (DataSize == 0) {
-
-	}
-	else
+	if ((msg.size() < sizeof(TDataItemHeader) + DataSize) ||
+		((DataSize != 0) && ((DataSize < entry.minLen) || (DataSize > entry.maxLen))))
 	{
-		data.insert(data.end(), msg.cbegin() + sizeof(TDataItemHeader), msg.cbegin() + sizeof(TDataItemHeader) + DataSize);
-
-		result = validateDataItemPayload(head->DId, data);
-		if (result != ERR_SUCCESS){
-			Error("TDataItem::fromBytes() failed validateDataItemPayload with status: " + std::to_string(result) + ", " + err_msg[-result]);
-			return PTDataItem(new TDataItem());
-		}
+		result = ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH;
+		Error("TDataItem::fromBytes() failed validateDataItemPayload with status: " + std::to_string(result) + ", " + err_msg[-result]);
+		return TPayloadItem(PTDataItem());
 	}
-	Log("TDataItem::fromBytes sending to constructor: ", data);
-	for (auto entry : DIdList)
-		if (entry.DId == head->DId){
-			auto item = entry.Construct(data);
-			return item;
-		}
-	return PTDataItem(new TDataItem(head->DId, data));
+	TBytesView data = msg.subspan(sizeof(TDataItemHeader), DataSize);
+	Trace("TDataItem::fromBytes sending to constructor: ", data);
+	TPayloadItem item = entry.Construct(head->DId, data, arena);
+	result = item.getParseResult();
+	if (result != ERR_SUCCESS)
+		Error("TDataItem::fromBytes() " + std::string(entry.desc) + " rejected its Data: " + std::to_string(result) + ", " + err_msg[-result]);
+	return item;
 }
 #pragma endregion
 
@@ -322,25 +394,30 @@ TDataItem::TDataItem(DataItemIds DId)
 
 
 // parses vector of bytes (presumably received across TCP socket) into a TDataItem
-TDataItem::TDataItem(TBytes bytes) : TDataItem()
+TDataItem::TDataItem(TBytesView bytes) : TDataItem()
 {
 	Trace("bytes = ", bytes);
-	TError result = ERR_SUCCESS;
-	GUARD(bytes.size() < sizeof(TDataItemHeader), ERR_MSG_DATAITEM_TOO_SHORT, bytes.size());
+	if (!require(bytes.size() >= sizeof(TDataItemHeader), ERR_MSG_DATAITEM_TOO_SHORT))
+		return;
 
 	TDataItemHeader *head = (TDataItemHeader *)bytes.data();
-	GUARD(isValidDataItemID(head->DId), ERR_MSG_DATAITEM_ID_UNKNOWN, head->DId);
+	if (!require(isValidDataItemID(head->DId), ERR_MSG_DATAITEM_ID_UNKNOWN))
+		return;
 
 	TDataItemLength DataSize = head->dataLength;
-	GUARD(bytes.size() != sizeof(TDataItemHeader) + DataSize, ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH, DataSize);
+	if (!require(bytes.size() == sizeof(TDataItemHeader) + DataSize, ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH))
+		return;
 
-	this->Data = TBytes(bytes.begin() + sizeof(TDataItemHeader), bytes.end()); // extract the Data from the DataItem bytes
+	this->Id = head->DId;
+	this->Data = bytes.subspan(sizeof(TDataItemHeader)); // extract the Data from the DataItem bytes
 	if (DataSize > 0)
+	{
 		TError result = validateDataItemPayload(this->Id, Data); // TODO: change to parseData that returns vector of classes-of-data-types
-	return;
+		require(result == ERR_SUCCESS, result);
+	}
 }
 
-TDataItem::TDataItem(DataItemIds DId, TBytes bytes)
+TDataItem::TDataItem(DataItemIds DId, TBytesView bytes)
 {
 	this->setDId(DId);
 	this->Data = bytes;
@@ -368,32 +445,56 @@ DataItemIds TDataItem::getDId()
 bool TDataItem::isValidDataLength()
 {
 	bool result = false;
-	DataItemIds DId = this->getDId();
-	int index = TDataItem::getDIdIndex(DId);
+	int index = TDataItem::getDIdIndex(this->getDId());
 	TDataItemLength len = this->Data.size();
-	if ((this->getMinLength(DId) <= len) && (this->getMaxLength(DId) >= len))
+	if ((index >= 0) && (DIdList[index].minLen <= len) && (DIdList[index].maxLen >= len))
 	{
 		result = true;
 	}
 	return result;
 }
 
+TBytes TDataItem::calcPayload(bool bAsReply)
+{
+	TPayloadWriter sizer;
+	this->writePayload(sizer, bAsReply);
+	TBytes bytes(sizer.length);
+	TPayloadWriter out(bytes.data());
+	this->writePayload(out, bAsReply);
+	return bytes;
+}
+
+size_t TDataItem::encodedSize(bool bAsReply)
+{
+	TPayloadWriter sizer;
+	this->writePayload(sizer, bAsReply);
+	return sizeof(TDataItemHeader) + sizer.length;
+}
+
+size_t TDataItem::writeTo(__u8 *dest, bool bAsReply)
+{
+	TPayloadWriter out(dest + sizeof(TDataItemHeader));
+	this->writePayload(out, bAsReply);
+	TPayloadWriter head(dest);
+	head.put<TDataId>(this->Id);
+	head.put<TDataItemLength>(out.length);
+	return sizeof(TDataItemHeader) + out.length;
+}
+
 TBytes TDataItem::AsBytes(bool bAsReply)
 {
 	Trace("ENTER, bAsReply = " + std::to_string(bAsReply));
-	TBytes bytes;
-	this->pushDId(bytes);
-	this->Data = this->calcPayload(bAsReply);
-	this->pushLen(bytes, this->Data.size());
-
-	bytes.insert(end(bytes), begin(Data), end(Data));
+	TBytes bytes(this->encodedSize(bAsReply));
+	this->writeTo(bytes.data(), bAsReply);
+	// Data keeps a copy of the Payload, as before; it fits inline for all but the largest DataItems
+	this->Data = TBytesView(bytes).subspan(sizeof(TDataItemHeader));
 	Trace("Built: ", bytes);
 	return bytes;
 }
 
 std::string TDataItem::getDIdDesc()
 {
-	return std::string(DIdList[TDataItem::getDIdIndex(this->getDId())].desc);
+	return TDataItem::getDIdDesc(this->getDId());
 }
 
 // returns human-readable, formatted (multi-line) string version of this TDataItem
@@ -423,6 +524,26 @@ TDataItem &TDataItem::Go()
 	return *this;
 }
 
+TResourceMask TDataItem::getResources()
+{
+	switch (this->Id >> 8)
+	{
+	case BRD_ >> 8:
+		return (this->Id == BRD_Reset) ? resAll : resBoard;
+	case DAC_ >> 8:
+		return resDac;
+	case DIO_ >> 8:
+		return resDio;
+	case ADC_ >> 8:
+	case ADC_Stream >> 8:
+		return resAdc;
+	case REG_ >> 8: // REG_ classes override this; any that don't could touch anything
+		return resAll;
+	default:
+		return resBoard;
+	}
+}
+
 TError TDataItem::getResultCode()
 {
 	Trace("resultCode: " + std::to_string(this->resultCode));
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <cstring>
+#include <string>
+
 #include "../eNET-types.h"
 #include "../TError.h"
+#include "../inline_bytes.h"
 
 
 #pragma region TDataItem DId enum
@@ -20,11 +24,12 @@ enum DataItemIds : TDataId // specific numbering, ordering, and grouping are pre
 	BRD_Features,
 	BRD_FpgaID,
 	BRD_stuff_needed_for_control_and_diagnostics_of_Linux_TCPIP_WDG_DEF_ETC, // TBD, long list
+	BRD_Select, // which of the server's boards a Control connection's Messages act on
 
 	REG_ = 0x100, // Query Only.
 	// NOTE: REG_ister access functionality does not allow (at this time) specifying 8-. 16-, or 32-bit access width.
 	//       Instead, the width is determined automatically from the register offset, because none of the eNET-AIO registers are flexible
-	//    Additionally, the TDataItem::fromBytes() factory method will throw an error if an invalid offset is passed,
+	//    Additionally, the TDataItem::fromBytes() factory method will fail with ERR_DId_BAD_OFFSET if an invalid offset is passed,
 	//       like offset=0x41 is invalid because 0x40 is a 32-bit register
 	// NOTE: int widthFromOffset(int ofs) is used to determine the register width but it is hard-coded, specific to eNET-AIO, by ranges
 	//       of offsets. We'll want the aioenetd to eventually support OTHER (non-eNET-AIO16-128A Family) eNET- boards so this will
@@ -155,7 +160,7 @@ typedef struct
 } TDataItemHeader;
 #pragma pack(pop)
 
-int validateDataItemPayload(DataItemIds DataItemID, TBytes Data);
+int validateDataItemPayload(DataItemIds DataItemID, TBytesView Data);
 
 #define printBytes(dest, intro, buf, crlf)                                                       \
 	{                                                                                            \
@@ -170,6 +175,17 @@ int validateDataItemPayload(DataItemIds DataItemID, TBytes Data);
 // returns 0 if offset is invalid
 int widthFromOffset(int ofs);
 
+// the hardware a DataItem's .Go() touches; Messages whose masks don't overlap may run at the same time (aioenetd's ActionThread)
+typedef __u32 TResourceMask;
+#define resAdc   ((TResourceMask)1 << 0) // ADC registers (+01 → +2C, calibration) and the ADC stream
+#define resDac   ((TResourceMask)1 << 1) // DAC SPI bus (+30 → +34)
+#define resDio   ((TResourceMask)1 << 2) // DIO SPI bus (+3C → +44)
+#define resBoard ((TResourceMask)1 << 3) // everything else: SubMux, FPGA/flash, config files, hostname
+#define resAll   (resAdc | resDac | resDio | resBoard) // Reset, and anything we can't pin down
+
+// return the resource(s) a register access at the given offset touches, as defined for eNET-AIO registers
+TResourceMask resourcesFromOffset(int ofs);
+
 template <typename T> void stuff(TBytes & buf, const T v)
 {
 	auto value = v;
@@ -186,6 +202,43 @@ template <typename T=std::string> void stuff(TBytes & buf, const std::string v)
 		buf.push_back(c);
 }
 
+// Writes little-endian fields straight into a caller-supplied buffer; constructed without a buffer it only counts,
+// so the same writePayload() code yields both a DataItem's exact encoded size and its bytes.
+class TPayloadWriter
+{
+public:
+	TPayloadWriter(__u8 *dest = nullptr) : dest(dest) {}
+
+	template <typename T> void put(const T v)
+	{
+		auto value = v;
+		for (int i = 0; i < sizeof(T); i++)
+		{
+			if (dest)
+				dest[length + i] = value & 0xFF;
+			value >>= 8;
+		}
+		length += sizeof(T);
+	}
+
+	void put(TBytesView bytes)
+	{
+		if (dest && bytes.size())
+			memcpy(dest + length, bytes.data(), bytes.size());
+		length += bytes.size();
+	}
+
+	void put(const std::string &s)
+	{
+		put(TBytesView((const __u8 *)s.data(), s.size()));
+	}
+
+	size_t length = 0;
+
+protected:
+	__u8 *dest;
+};
+
 // void stuff32(TBytes & buf, const __u32 v)
 // {
 // 	auto value = v;
@@ -197,10 +250,11 @@ template <typename T=std::string> void stuff(TBytes & buf, const std::string v)
 // }
 
 
-// utility template to turn class into (base-class)-pointer-to-instance-on-heap, so derived class gets called
-template <class X> std::unique_ptr<TDataItem> construct(TBytes FromBytes) { return std::unique_ptr<TDataItem>(new X(FromBytes)); }
-typedef std::unique_ptr<TDataItem> DIdConstructor(TBytes FromBytes);
+// one element of a TPayload; see TPayload.h, which also has the construct<X>() template DIdList[] uses
+class TPayloadItem;
+typedef TPayloadItem DIdConstructor(DataItemIds DId, TBytesView FromBytes, std::pmr::memory_resource *arena);
 
+// everything the server knows about one DId, in one record; found via getDIdIndex() in O(1)
 typedef struct
 {
 	DataItemIds DId;
@@ -208,12 +262,16 @@ typedef struct
 	TDataItemLength expectedLen;
 	TDataItemLength maxLen;
 	DIdConstructor *Construct;
-	std::string desc;
+	const char *desc;
 } TDIdListEntry;
 
 extern TDIdListEntry const DIdList[];
 
 
+// bytes of a DataItem's Data held inside the DataItem; bigger Data (CFG_Hostname, REG_ReadBuf results) goes to the heap
+#define DATAITEM_INLINE_DATA 24
+typedef TInlineBytes<DATAITEM_INLINE_DATA> TDataBytes;
+
 #pragma region "class TDataItem" declaration
 
 /*	The following classes (TDataItem and its descendants) try to use a consistent convention
@@ -233,20 +291,36 @@ public:
 
 	// factory fromBytes() instantiates appropriate (sub-)class of TDataItem via DIdList[]
 	// .fromBytes() would typically be called by TMessage::fromBytes();
-	static PTDataItem fromBytes(TBytes msg, TError &result);
+	// msg is a view of one DataItem (header + Data) inside the received Message; it is not copied.
+	// The DataItem is held by value in the returned TPayloadItem if its class is one of TDataItemVariant's, otherwise
+	// allocated from arena; the default is the heap
+	// Nothing on this path throws: a malformed DataItem sets result, and the constructor's own complaint (see
+	// getParseResult()) is passed on exactly
+	static TPayloadItem fromBytes(TBytesView msg, TError &result,
+								std::pmr::memory_resource *arena = std::pmr::get_default_resource());
+	// ERR_SUCCESS, or the first reason this DataItem's constructor rejected its Data
+	TError getParseResult() { return parseResult; }
 
 	// this block of methods are typically used by ::fromBytes() to syntax-check the byte vector
-	static int validateDataItemPayload(DataItemIds DataItemID, TBytes Data);
+	static int validateDataItemPayload(DataItemIds DataItemID, TBytesView Data);
 	static int isValidDataItemID(DataItemIds DataItemID);
-	static int validateDataItem(TBytes msg);
+	static int validateDataItem(TBytesView msg);
 	static TDataItemLength getMinLength(DataItemIds DId);
 	static TDataItemLength getTargetLength(DataItemIds DId);
 	static TDataItemLength getMaxLength(DataItemIds DId);
 
-	// index into DIdList; TODO: kinda belongs in a DIdList class method...
+	// index into DIdList, or -1 if DId is unknown; O(1) via a compile-time table keyed on the DId's group (high byte)
+	// and index (low byte).  TODO: kinda belongs in a DIdList class method...
 	static int getDIdIndex(DataItemIds DId);
-	// serialize the Payload portion of the Data Item; calling this->calcPayload is done by TDataItem.AsBytes(), only
-	virtual TBytes calcPayload(bool bAsReply = false) {return Data;}
+	// emit the Payload portion of the Data Item; the only per-class serialization code, called once to size and once to write
+	virtual void writePayload(TPayloadWriter &out, bool bAsReply = false) { out.put(TBytesView(Data)); }
+	// serialize the Payload portion of the Data Item into a new TBytes; calling this->calcPayload is done by TDataItem.AsBytes(), only
+	virtual TBytes calcPayload(bool bAsReply = false);
+	// exact number of bytes writeTo() will produce: header plus Payload
+	size_t encodedSize(bool bAsReply = false);
+	// serialize header and Payload into dest, which must hold encodedSize() bytes; returns the bytes written
+	// this is the allocation-free path used by TMessage::writeTo()
+	size_t writeTo(__u8 *dest, bool bAsReply = false);
 	// serialize for sending via TCP; calling TDataItem.AsBytes() is normally done by TMessage::AsBytes()
 	virtual TBytes AsBytes(bool bAsReply=false);
 	// push DId into buf; utility for AsBytes()
@@ -260,7 +334,7 @@ public:
 	// some-"Data" constructor for specific DId; *RARE*, *DEBUG mainly, to test round-trip conversion implementation*
 	// any DId that is supposed to have data would use its own constructor that takes the correct data types, not a
 	// simple TBytes, for the Data Payload
-	TDataItem(DataItemIds DId, TBytes bytes);
+	TDataItem(DataItemIds DId, TBytesView bytes);
 
 	// TODO: WARN: Why would this *ever* be used?
 	TDataItem();
@@ -276,12 +350,14 @@ public:
 
 	// parse byte array into TDataItem; *RARE*, *DEBUG mainly, to test round-trip conversion implementation*
 	// this is an explicit class-specific .fromBytes(), which the class method .fromBytes() will invoke for NYI DIds etc
-	TDataItem(TBytes bytes);
+	TDataItem(TBytesView bytes);
 
 	// 3) Verbs -- things used when *executing* the TDataItem Object
 public:
 	// intended to be overriden by descendants it performs the query/config operation and sets instance state as appropriate
 	virtual TDataItem &Go();
+	// the hardware .Go() touches; by DId group unless a descendant knows better (e.g., REG_ by offset)
+	virtual TResourceMask getResources();
 	// encapsulates the result code of .Go()'s operation
 	virtual TError getResultCode();
 	// encapsulates the Value that results from .Go()'s operation; DIO_Read1() might have a bool Value;
@@ -298,8 +374,20 @@ public:
 	static std::string getDIdDesc(DataItemIds DId);
 
 protected:
-	TBytes Data;
-	TError resultCode;
+	// the constructors' GUARD(): records resultcode as the parse result instead of throwing, so a hostile packet costs
+	// a compare, not an exception.  Returns allGood; the first failure sticks.  Use as
+	//		if (!require(cond, ERR_...)) return;
+	bool require(bool allGood, TError resultcode)
+	{
+		if (!allGood && (parseResult == ERR_SUCCESS))
+			parseResult = resultcode;
+		return allGood;
+	}
+
+protected:
+	TDataBytes Data;
+	TError resultCode = ERR_SUCCESS;
+	TError parseResult = ERR_SUCCESS;
 	int conn;
 
 protected:
@@ -313,6 +401,6 @@ class TDataItemNYI : public TDataItem
 {
 public:
 	TDataItemNYI() = default;
-	TDataItemNYI(TBytes buf) : TDataItem::TDataItem{buf}{};
+	TDataItemNYI(DataItemIds DId, TBytesView buf) : TDataItem::TDataItem{DId, buf}{};
 };
 #pragma endregion
@@ -0,0 +1,118 @@
+#pragma once
+/*
+	A Message's Payload: its DataItems, in order, stored by value.
+
+	Every implemented DataItem class is one alternative of a closed std::variant, so a Payload is one contiguous
+	array with no per-DataItem allocation or refcount, and .Go(), serialization etc. dispatch with std::visit to the
+	concrete (final) class; the compiler sees straight through those calls.  Everything else -- NYI DIds, the
+	generic TDataItem, classes added later and not (yet) listed here -- rides in the last alternative as a PTDataItem,
+	and dispatches virtually, as before.
+
+	Adding a class to TDataItemVariant is only worth it for DIds on the hot path; it grows every slot to the size of
+	the biggest alternative.  Keep it to 11 alternatives: up to there libstdc++'s std::visit is a switch the compiler
+	can inline, past it a table of function pointers, no better than the vtable.
+*/
+
+#include <type_traits>
+#include <variant>
+
+#include "TDataItem.h"
+#include "ADC_.h"
+#include "BRD_.h"
+#include "CFG_.h"
+#include "DAC_.h"
+#include "REG_.h"
+
+typedef std::variant<TREG_Read1, TREG_Write1,
+					 TDAC_Output, TDAC_Range1,
+					 TBRD_FpgaID, TBRD_DeviceID, TBRD_Features,
+					 TADC_StreamStart, TADC_StreamStop,
+					 TCFG_Hostname,
+					 PTDataItem>
+	TDataItemVariant;
+
+// true if X is held by value in a TPayloadItem
+template <class X, class V = TDataItemVariant> struct isPayloadAlternative;
+template <class X, class... Alternatives>
+struct isPayloadAlternative<X, std::variant<Alternatives...>> : std::bool_constant<(std::is_same_v<X, Alternatives> || ...)> {};
+
+class TPayloadItem
+{
+public:
+	// a DataItem of a by-value class, constructed in place
+	template <class X, class... Args>
+	TPayloadItem(std::in_place_type_t<X> type, Args &&...args) : item(type, std::forward<Args>(args)...) {}
+	// any other DataItem
+	TPayloadItem(PTDataItem dataItem) : item(std::move(dataItem)) {}
+
+	// calls f with the DataItem as its own class, or as a TDataItem & for PTDataItems
+	template <class F>
+	decltype(auto) visit(F &&f)
+	{
+		return std::visit([&](auto &x) -> decltype(auto) {
+			if constexpr (std::is_same_v<std::decay_t<decltype(x)>, PTDataItem>)
+				return f(*x);
+			else
+				return f(x);
+		}, item);
+	}
+
+	// the TDataItem methods the server calls per DataItem, each dispatched by visit(); x is the final class itself, so
+	// x.Go() etc. are direct calls
+	void Go() { visit([](auto &x) { x.Go(); }); }
+	DataItemIds getDId() { return visit([](auto &x) { return x.getDId(); }); }
+	TResourceMask getResources() { return visit([](auto &x) { return x.getResources(); }); }
+	TError getParseResult() { return visit([](auto &x) { return x.getParseResult(); }); }
+
+	// as TDataItem::encodedSize() and writeTo(), but calling writePayload() on x: inside TDataItem's own, `this` is
+	// only a TDataItem, and the call stays virtual
+	size_t encodedSize(bool bAsReply = false)
+	{
+		return visit([=](auto &x) {
+			TPayloadWriter sizer;
+			x.writePayload(sizer, bAsReply);
+			return sizeof(TDataItemHeader) + sizer.length;
+		});
+	}
+
+	size_t writeTo(__u8 *dest, bool bAsReply = false)
+	{
+		return visit([=](auto &x) {
+			TPayloadWriter out(dest + sizeof(TDataItemHeader));
+			x.writePayload(out, bAsReply);
+			TPayloadWriter head(dest);
+			head.put<TDataId>(x.getDId());
+			head.put<TDataItemLength>(out.length);
+			return sizeof(TDataItemHeader) + out.length;
+		});
+	}
+
+	TBytes AsBytes(bool bAsReply = false) { return visit([=](auto &x) { return x.AsBytes(bAsReply); }); }
+	std::string AsString(bool bAsReply = false) { return visit([=](auto &x) { return x.AsString(bAsReply); }); }
+
+protected:
+	TDataItemVariant item;
+};
+
+// allocator-aware, so a received Message's Payload can live in its TMessageArena
+typedef std::pmr::vector<TPayloadItem> TPayload;
+
+// utility template to turn a DIdList[] entry's class into a TPayloadItem
+// the constructor gets a view of the DataItem's Data in the receive buffer; anything it keeps, it copies exactly once,
+// into the instance that owns it.
+// generic classes (TDataItem, TDataItemNYI) are also handed the DId, as nothing else tells them which one they are.
+// By-value classes are built in the TPayloadItem; others are a PTDataItem whose instance and shared_ptr control block
+// are one allocation, from arena (the Message's TMessageArena)
+template <class X> TPayloadItem construct(DataItemIds DId, TBytesView FromBytes, std::pmr::memory_resource *arena)
+{
+	if constexpr (isPayloadAlternative<X>::value)
+		return TPayloadItem(std::in_place_type<X>, FromBytes);
+	else
+	{
+		std::pmr::polymorphic_allocator<X> alloc(arena);
+		if constexpr (std::is_constructible_v<X, DataItemIds, TBytesView>)
+			return TPayloadItem(std::allocate_shared<X>(alloc, DId, FromBytes));
+		else
+			return TPayloadItem(std::allocate_shared<X>(alloc, FromBytes));
+	}
+}
@@ -30,6 +30,7 @@ typedef __u32 TError;
 #define ERR_NYI -13
 #define ERR_ADC_BUSY -14
 #define ERR_ADC_FATAL -15
+#define ERR_BUSY -16
 
 
 extern const char *err_msg[];
@@ -67,24 +67,9 @@ const vector<TMessageId> ValidMessageIDs{
 */
 
 
-template <typename T> std::vector<T> slicing(std::vector<T> const &v, int Start, int End)
-{
-
-	// Begin and End iterator
-	auto first = v.begin() + Start;
-	auto last = v.begin() + End + 1;
-
-	// Copy the element
-	std::vector<T> vector(first, last);
-
-	// Return the results
-	return vector;
-}
-
-
 #pragma region TMessage implementation
 
-TCheckSum TMessage::calculateChecksum(TBytes Message)
+TCheckSum TMessage::calculateChecksum(TBytesView Message)
 {
 
 	TCheckSum checksum = 0;
@@ -97,9 +82,9 @@ bool TMessage::isValidMessageID(TMessageId MessageId)
 {
 
 	bool result = false;
-	for (int i = 0; i < sizeof(ValidMessageIDs) / sizeof(TMessageId); i++)
+	for (TMessageId anId : ValidMessageIDs)
 	{
-		if (ValidMessageIDs[i] == MessageId)
+		if (anId == MessageId)
 		{
 			result = true;
 			break;
@@ -112,37 +97,32 @@ bool TMessage::isValidMessageID(TMessageId MessageId)
 // returns 0 if the Payload is well-formed
 // this means that all the Data Items are well formed and the total size matches the expectation
 // "A Message has an optional Payload, which is a sequence of zero or more Data Items"
-TError TMessage::validatePayload(TBytes Payload)
+TError TMessage::validatePayload(TBytesView Payload)
 {
-
-	// WARN: Does not seem to work as expected when parsing multiple DataItems
 	TError result = ERR_SUCCESS;
 	if (Payload.size() == 1) // one-byte Payload is "the checksum byte".
 		return result;
 
 	if (Payload.size() == 0) // zero-length Payload size is a valid payload
 		return ERR_MSG_DATAITEM_TOO_SHORT;
-	if (Payload.size() < sizeof(TDataItemHeader))
-		return ERR_MSG_DATAITEM_TOO_SHORT;
 
-	TDataItemHeader *head = (TDataItemHeader *)Payload.data();
-
-	int DataItemSize = sizeof(TDataItemHeader) + head->dataLength;
-	if (DataItemSize > Payload.size())
+	while (Payload.size() > 1) // a lone trailing byte is the checksum
 	{
-		Error("--ERR: data item thinks it is longer than payload, disize: " + std::to_string(DataItemSize) +", psize: " + std::to_string(Payload.size()));
-		result = ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH;
-	}
-	else
-	{
-		TBytes DataItem = slicing(Payload, 0, DataItemSize);
-		result = TDataItem::validateDataItem(DataItem);
-		if (result == 0) // if the Data Item is well-formed, check the next one
+		if (Payload.size() < sizeof(TDataItemHeader))
+			return ERR_MSG_DATAITEM_TOO_SHORT;
+
+		TDataItemHeader *head = (TDataItemHeader *)Payload.data();
+		size_t DataItemSize = sizeof(TDataItemHeader) + head->dataLength;
+		if (DataItemSize > Payload.size())
 		{
-			Payload.erase(Payload.cbegin(), Payload.cbegin() + DataItemSize);
-			if (Payload.size() > 0)
-				result = validatePayload(Payload);
+			Error("--ERR: data item thinks it is longer than payload, disize: " + std::to_string(DataItemSize) +", psize: " + std::to_string(Payload.size()));
+			return ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH;
 		}
+
+		result = TDataItem::validateDataItem(Payload.first(DataItemSize));
+		if (result != ERR_SUCCESS)
+			break;
+		Payload = Payload.subspan(DataItemSize); // if the Data Item is well-formed, check the next one
 	}
 
 	return result;
@@ -150,7 +130,7 @@ TError TMessage::validatePayload(TBytes Payload)
 
 // Checks the Message for well-formedness
 // returns 0 if Message is well-formed
-TError TMessage::validateMessage(TBytes buf) // "NAK()" is shorthand for return error condition etc
+TError TMessage::validateMessage(TBytesView buf) // "NAK()" is shorthand for return error condition etc
 {
 	Trace("ENTER: RAW Message: ", buf);
 	if (buf.size() < minimumMessageLength)
@@ -161,7 +141,7 @@ TError TMessage::validateMessage(TBytes buf) // "NAK()" is shorthand for return
 	if (!isValidMessageID(head->type))
 		return ERR_MSG_ID_UNKNOWN; // NAK(invalid MessageId Category byte)
 
-	__u32 statedMessageLength = minimumMessageLength + head->payload_size;
+	__u32 statedMessageLength = minimumMessageLength + PAYLOAD_SIZE(head->payload_size);
 	if (buf.size() < statedMessageLength)
 		return ERR_MSG_LEN_MISMATCH; // NAK(received insufficient data, yet) until more data
 
@@ -171,10 +151,7 @@ TError TMessage::validateMessage(TBytes buf) // "NAK()" is shorthand for return
 		Error("calculated csum: "+std::to_string(checksum)+" ERROR should be zero\n");
 		return ERR_MSG_CHECKSUM; // NAK(invalid checksum)
 }
-	TBytes payload = buf;
-	payload.erase(payload.cbegin(), payload.cbegin() + sizeof(TMessageHeader));
-
-	TError validPayload = validatePayload(payload);
+	TError validPayload = validatePayload(buf.subspan(sizeof(TMessageHeader)));
 	if (validPayload != 0)
 		return validPayload;
 
@@ -184,45 +161,49 @@ TError TMessage::validateMessage(TBytes buf) // "NAK()" is shorthand for return
  * This function parses an array of bytes that is supposed to be a Payload
  * ...then returns a vector of those TDataItems and sets result to indicate error/success
  */
-TPayload TMessage::parsePayload(TBytes Payload, __u32 payload_length, TError &result)
+TPayload TMessage::parsePayload(TBytesView Payload, TError &result, std::pmr::memory_resource *arena)
 {
 
-	TPayload dataItems; // an empty vector<>
+	TPayload dataItems(arena); // an empty vector<>
 	result = ERR_SUCCESS;
-	if (payload_length == 0){ // zero-length payload size is a valid payload
+	if (Payload.size() == 0){ // zero-length payload size is a valid payload
 		return dataItems;
 	}
 
-	TBytes DataItemBytes = Payload; // pointer to start of byte[] Payload
-	while (payload_length >= sizeof(TDataItemHeader))
+	// size the vector once, from the DataItem headers; an arena never gets back what a growing vector leaves behind
+	size_t count = 0;
+	for (TBytesView rest = Payload; rest.size() >= sizeof(TDataItemHeader); count++)
+		rest = rest.subspan(std::min(rest.size(), sizeof(TDataItemHeader) + ((TDataItemHeader *)rest.data())->dataLength));
+	dataItems.reserve(count);
+
+	while (Payload.size() >= sizeof(TDataItemHeader))
 	{
-		TDataItemHeader *head = (TDataItemHeader *)DataItemBytes.data();
+		TDataItemHeader *head = (TDataItemHeader *)Payload.data();
 		// DataItemLength is the size of the Data Item, including the size of the Data Item Length
 		// + Data Item ID, and the Data Item's payload's bytelength
-		int DataItemLength = sizeof(TDataItemHeader) + head->dataLength; // DataItem[3] is payload length
-		if (DataItemLength > payload_length)
+		size_t DataItemLength = sizeof(TDataItemHeader) + head->dataLength;
+		if (DataItemLength > Payload.size())
 		{
 			result = ERR_MSG_PAYLOAD_DATAITEM_LEN_MISMATCH;
 			Error("TMessage::parsePayload: DataItemLength > payload_length returned error " + std::to_string(result) + ", " + err_msg[-result]);
 			break;
 		}
 
-		PTDataItem item = TDataItem::fromBytes(DataItemBytes, result);
+		TPayloadItem item = TDataItem::fromBytes(Payload.first(DataItemLength), result, arena);
 		if (result != ERR_SUCCESS)
 		{
 			Error("TMessage::parsePayload: DIAG::fromBytes returned error " + std::to_string(result) + ", " + err_msg[-result]);
 			break;
 		}
-		dataItems.push_back(item);
+		dataItems.push_back(std::move(item));
 
-		// remove the bytes from the Payload that were parsed into 'item'
-		DataItemBytes.erase(DataItemBytes.cbegin(), DataItemBytes.cbegin() + DataItemLength);
-		payload_length -= DataItemLength;
+		// step past the bytes that were parsed into 'item'
+		Payload = Payload.subspan(DataItemLength);
 	}
 	return dataItems;
 }
 
-TMessage TMessage::FromBytes(TBytes buf, TError &result)
+TMessage TMessage::FromBytes(TBytesView buf, TError &result, std::pmr::memory_resource *arena)
 {
 
 	result = ERR_SUCCESS;
@@ -233,7 +214,7 @@ TMessage TMessage::FromBytes(TBytes buf, TError &result)
 	{
 		result = ERR_MSG_TOO_SHORT;
 		Error("Message Size < minimumMessageLength ("+std::to_string(siz)+" < " + std::to_string(minimumMessageLength));
-		return TMessage(_INVALID_MESSAGEID_); // NAK(received insufficient data, yet) until more data (the rest of the Message/header) received?
+		return TMessage(); // NAK(received insufficient data, yet) until more data (the rest of the Message/header) received?
 	}
 	TMessageHeader *head = (TMessageHeader *)buf.data();
 
@@ -243,25 +224,16 @@ TMessage TMessage::FromBytes(TBytes buf, TError &result)
 		Error("TMessage::FromBytes: detected invalid MId: "+ std::to_string(result) + ", " + err_msg[-result]);
 		return TMessage();
 	}
-	__u32 statedMessageLength = minimumMessageLength + head->payload_size;
+	TMessagePayloadSize payload_size = PAYLOAD_SIZE(head->payload_size);
+	__u32 statedMessageLength = minimumMessageLength + payload_size;
 	if (siz < statedMessageLength)
 	{
 		result = ERR_MSG_LEN_MISMATCH; // NAK(received insufficient data, yet) until more data
 		return TMessage();
 	}
 
-	TPayload dataItems;
-	if (head->payload_size > 0)
-	{
-		Trace("TMessage::FromBytes: Payload is " + std::to_string(head->payload_size) + " bytes");
-		TBytes payload = buf;
-		payload.erase(payload.cbegin(), payload.cbegin() + sizeof(TMessageHeader));
-		Trace("TMessage::FromBytes generated payload: ", payload);
-		dataItems = parsePayload(payload, head->payload_size, result);
-		Trace("parsePayload returned " + std::to_string(dataItems.size()) + " with resultCode " + std::to_string(result));
-	}
-
-	TCheckSum checksum = calculateChecksum(buf);
+	// checksum first: no point constructing DataItems from a corrupt Message
+	TCheckSum checksum = calculateChecksum(buf.first(statedMessageLength));
 	if (__valid_checksum__ != checksum)
 	{
 		result = ERR_MSG_CHECKSUM; // NAK(invalid checksum)
@@ -269,7 +241,15 @@ TMessage TMessage::FromBytes(TBytes buf, TError &result)
 		return TMessage();
 	}
 
-	TMessage message = TMessage(head->type, dataItems);
+	TMessage message(head->type, arena);
+	message.bUrgent = head->payload_size & bmMessageUrgent;
+	if (payload_size > 0)
+	{
+		Trace("TMessage::FromBytes: Payload is " + std::to_string(payload_size) + " bytes");
+		message.DataItems = parsePayload(buf.subspan(sizeof(TMessageHeader), payload_size), result, arena);
+		Trace("parsePayload returned " + std::to_string(message.DataItems.size()) + " with resultCode " + std::to_string(result));
+	}
+
 	Trace("TMessage::FromBytes: TMessage constructed...Payload DataItem Count: "+ std::to_string(message.DataItems.size()));
 	return message;
 }
@@ -280,13 +260,19 @@ TMessage::TMessage(TMessageId MId)
 	this->setMId(MId);
 }
 
+TMessage::TMessage(TMessageId MId, std::pmr::memory_resource *arena) : DataItems(arena)
+{
+
+	this->setMId(MId);
+}
+
 TMessage::TMessage(TMessageId MId, TPayload Payload)
 {
 
 	this->setMId(MId);
-	for (auto one : Payload)
+	for (auto &one : Payload)
 	{
-		DataItems.push_back(one);
+		DataItems.push_back(std::move(one));
 	}
 	// DataItems = Payload;
 }
@@ -329,32 +315,32 @@ TMessage &TMessage::addDataItem(PTDataItem item)
 	return *this;
 }
 
-TBytes TMessage::AsBytes(bool bAsReply)
+size_t TMessage::encodedSize(bool bAsReply)
 {
+	size_t length = minimumMessageLength;
+	for (auto &item : this->DataItems)
+		length += item.encodedSize(bAsReply);
+	return length;
+}
 
-	TMessagePayloadSize payloadLength = 0;
-	for (auto item : this->DataItems)
-	{
-		payloadLength += item->AsBytes(bAsReply).size();
-	}
-	TBytes bytes;
-
-	bytes.push_back(this->Id);
+size_t TMessage::writeTo(__u8 *dest, bool bAsReply)
+{
+	size_t length = sizeof(TMessageHeader);
+	for (auto &item : this->DataItems)
+		length += item.writeTo(dest + length, bAsReply);
 
-	for (int i=0; i < (sizeof(TMessagePayloadSize)); i++){ // push message payload length
-		__u8 lsb = payloadLength & 0xFF;
-		bytes.push_back(lsb);
-		payloadLength >>= 8;
-	}
+	TPayloadWriter head(dest);
+	head.put<TMessageId>(this->Id);
+	head.put<TMessagePayloadSize>(length - sizeof(TMessageHeader));
 
-	for (auto item : this->DataItems)
-	{
-		TBytes byt = item->AsBytes(bAsReply);
-		bytes.insert(end(bytes), begin(byt), end(byt));
-	}
+	dest[length] = -calculateChecksum(TBytesView(dest, length)); // WARN: only works because TCheckSum == __u8
+	return length + sizeof(TCheckSum);
+}
 
-	TCheckSum csum = -calculateChecksum(bytes);
-	bytes.push_back(csum); // WARN: only works because TCheckSum == __u8
+TBytes TMessage::AsBytes(bool bAsReply)
+{
+	TBytes bytes(this->encodedSize(bAsReply));
+	this->writeTo(bytes.data(), bAsReply);
 	Trace("Built: ", bytes);
 
 	return bytes;
@@ -371,9 +357,9 @@ string TMessage::AsString(bool bAsReply)
 	{
 		for (int itemNumber = 0; itemNumber < DataItems.size(); itemNumber++)
 		{
-			PTDataItem item = this->DataItems[itemNumber];
+			TPayloadItem &item = this->DataItems[itemNumber];
 			dest << endl
-				 << "           " << setw(2) << itemNumber+1 << ": " << item->AsString(bAsReply);
+				 << "           " << setw(2) << itemNumber+1 << ": " << item.AsString(bAsReply);
 		}
 	}
 	return dest.str();
@@ -133,14 +133,16 @@ TODO: finish writing the descendants of TDataItem.  See validateDataItemPayload(
 #include "TError.h"
 #include "DataItems/TDataItem.h"
 #include "DataItems/CFG_.h"
+#include "DataItems/TPayload.h"
 
 
-extern int apci; // global handle to device file for DAQ circuit on which to perform reads/writes
-
 #define __valid_checksum__ (TCheckSum)(0)
 #define minimumMessageLength ((__u32)(sizeof(TMessageHeader) + sizeof(TCheckSum)))
 #define maxDataLength (std::numeric_limits<TDataItemLength>::max())
 #define maxPayloadLength ((__u32)(sizeof(TDataItemHeader) + maxDataLength) * 16)
+// payload_size bit 31 asks for a Message to be run ahead of the queue (aioenetd's urgent class); the rest is the size
+#define bmMessageUrgent ((TMessagePayloadSize)0x80000000)
+#define PAYLOAD_SIZE(payload_size) ((payload_size) & ~bmMessageUrgent)
 
 
 #pragma region class TMessage declaration
@@ -149,24 +151,33 @@ class TMessage
 public:
 	// Sums all bytes in Message, specifically including the checksum byte
 	// WARNING: this algorithm only works if TChecksum is a byte
-	static TCheckSum calculateChecksum(TBytes Message);
+	static TCheckSum calculateChecksum(TBytesView Message);
 	static bool isValidMessageID(TMessageId MessageId);
 	// Checks the Payload for well-formedness
 	// returns 0 if the Payload is well-formed
 	// this means that all the Data Items are well formed and the total size matches the expectation
 	// "A Message has an optional Payload, which is a sequence of zero or more Data Items"
-	static TError validatePayload(TBytes Payload);
+	static TError validatePayload(TBytesView Payload);
 	// Checks the Message for well-formedness
 	// returns 0 if Message is well-formed
-	static TError validateMessage(TBytes buf);
+	static TError validateMessage(TBytesView buf);
 	/* A Payload consists of zero or more DataItems
 	 * This function parses an array of bytes that is supposed to be a Payload
 	 * ...then returns a vector of those TDataItems and sets result to indicate error/success
+	 * The Payload is walked once, front to back, as views into the caller's buffer; nothing is copied until
+	 * each DataItem's constructor takes its own Data.  The vector and the DataItems are allocated from arena.
+	 * On a syntax error result says what is wrong and the vector holds the DataItems before the one that is, so its
+	 * size() is the bad DataItem's index.
 	 */
-	static TPayload parsePayload(TBytes Payload, __u32 payload_length, TError &result);
+	static TPayload parsePayload(TBytesView Payload, TError &result,
+								 std::pmr::memory_resource *arena = std::pmr::get_default_resource());
 	// factory method but might not be as good as TDataItem::fromBytes()
 	// TODO: figure out F or f for the name
-	static TMessage FromBytes(TBytes buf, TError &result);
+	// buf is typically a view straight into the Control connection's receive buffer; arena is typically the
+	// Message's TMessageArena.  Move-construct the result into place: assigning it would copy the Payload
+	// out of the arena.  Nothing on this path throws: malformed input is a result code, never an exception
+	static TMessage FromBytes(TBytesView buf, TError &result,
+							  std::pmr::memory_resource *arena = std::pmr::get_default_resource());
 
 	static void pushLen(TBytes & buf, TMessagePayloadSize len)
 	{
@@ -181,6 +192,8 @@ public:
 public:
 	TMessage() = default;
 	TMessage(TMessageId MId);
+	// an empty Message whose Payload allocates from arena
+	TMessage(TMessageId MId, std::pmr::memory_resource *arena);
 	TMessage(TMessageId MId, TPayload Payload);
 	/*
 	 * This function parses a vector<byte> that is supposed to be an entire Message
@@ -192,6 +205,8 @@ public:
 
 public:
 	TMessageId getMId();
+	// the sender set bmMessageUrgent
+	bool isUrgent() { return bUrgent; }
 	TCheckSum getChecksum(bool bAsReply = false);
 	// set the MId ("MessageId")
 	TMessage &setMId(TMessageId MId);
@@ -200,6 +215,10 @@ public:
 
 	// returns this Message serialized into TBytes suitable for TCP send()
 	TBytes AsBytes(bool bAsReply = false);
+	// exact number of bytes writeTo() will produce: header, every DataItem, and checksum
+	size_t encodedSize(bool bAsReply = false);
+	// serializes this Message into dest, which must hold encodedSize() bytes, without allocating; returns bytes written
+	size_t writeTo(__u8 *dest, bool bAsReply = false);
 	// returns this Message as a human-readable std::string
 	std::string AsString(bool bAsReply = false);
 
@@ -210,6 +229,7 @@ public:
 protected:
 	TMessageId Id;
 	int conn;
+	bool bUrgent = false;
 };
 #pragma endregion TMessage declaration
 
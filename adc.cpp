@@ -15,7 +15,6 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/time.h> //FD_SET, FD_ISSET, FD_ZERO macros
-#include <semaphore.h>
 #include <pthread.h>
 #include <sys/mman.h>
 #include <signal.h>
@@ -24,120 +23,879 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <string.h>
+#include <deque>
+#include <algorithm>
+#include <sys/uio.h>
+#include <poll.h>
+#include <linux/errqueue.h>
 
 //#include "safe_queue.h"
 #include "logging.h"
 #include "TMessage.h"
 #include "TError.h"
 #include "eNET-AIO16-16F.h"
-#include "apcilib.h"
+#include "apci.h"
 #include "adc.h"
+#include "spsc_ring.h"
 
-static uint32_t ring_buffer[RING_BUFFER_SLOTS][SAMPLES_PER_TRANSFER];
+/*
+	ADC data reaches the subscribers' sender threads through TAdcStreamSession::Blocks, a lock-free ring of
+	TAdcBlocks: the acquisition thread publishes every block it takes from one IRQ with a single release store, each
+	sender sends from its own cursor in batches, and either side only sleeps (on a futex) when there's nothing to do.
+	Normally a block is a lease on the DMA slot itself: senders send straight out of the mmapped DMA buffer, and the
+	slot goes back to the card (DmaDataDone) once every subscriber is finished with it.  DmaDataDone() always
+	frees the *oldest* slots, so releases are retired in DMA order: see releaseDmaSlots().
 
-volatile int AdcStreamTerminate;
+	Fallback: while ADC_LEASE_HIGH_WATER DMA slots are already leased out (DmaLeased; the subscribers are draining
+	slower than the ADC fills) -- or if AIOENETD_ADC_ZEROCOPY=0 -- the acquisition copies the slot into CopyBuffer[]
+	and gives the DMA slot back immediately, so the card keeps its headroom and the copy buffer absorbs the backlog
+	instead.
+*/
+#define ADC_LEASE_HIGH_WATER (RING_BUFFER_SLOTS * 3 / 4)
 
-pthread_t worker_thread;
-pthread_t logger_thread;
 
-pthread_mutex_t mutex;
-sem_t empty;
-sem_t full;
+void TAdcStreamSession::releaseDmaSlots(const int *slots, int count, bool bLeased)
+{
+	std::lock_guard<std::mutex> lock(LeaseLock);
+	if (bLeased)
+		DmaLeased -= count;
+	for (int i = 0; i < count; i++)
+		DmaReleased[slots[i]] = true;
+	int done = 0;
+	while ((DmaHeld > 0) && DmaReleased[DmaOldest])
+	{
+		DmaReleased[DmaOldest] = false;
+		DmaOldest = (DmaOldest + 1) % RING_BUFFER_SLOTS;
+		DmaHeld--;
+		done++;
+	}
+	if (done)
+		Board->DmaDataDone(done);
+}
 
-timespec AdcLogTimeout;
+#pragma region sending blocks
+/*
+	Each subscriber's sender sends every block that's ready -- up to AIOENETD_ADC_BATCH_BYTES (default ADC_BATCH_BYTES),
+	and never more than its MaxLag -- with one sendmsg(), and releases them together, so catching up after a stall
+	costs a few syscalls rather than one per block.
+*/
+#define ADC_BATCH_BYTES (64 * BYTES_PER_TRANSFER)
+#define ADC_SUBSCRIBER_EXIT_MS 2000 // how long an ending acquisition lets its senders finish before cutting them off
 
-int AdcStreamingConnection = -1;
+/*
+	AIOENETD_ADC_MSG_ZEROCOPY=1 also skips the kernel's copy into socket buffers: the stream socket gets SO_ZEROCOPY
+	and blocks go out with sendmsg(MSG_ZEROCOPY), so the NIC reads them straight from the block.  The kernel then still
+	references the block after sendmsg() returns, so the block -- and its DMA slot -- stays leased until the matching
+	completion arrives on the socket's error queue (see reapZeroCopy()), not merely until sendmsg() returns.
 
-int AdcLoggerThreadID = -1;
-int AdcWorkerThreadID = -1;
+	Plain send() is used instead, for the rest of the stream, when
+		setsockopt(SO_ZEROCOPY) fails (kernel older than 4.14, or a socket type without zero-copy support)
+		a MSG_ZEROCOPY sendmsg() fails with EFAULT (memory the kernel can't pin, e.g. some DMA buffer mappings)
+		the first ADC_MSG_ZEROCOPY_PROBE completions all report the kernel copied anyway (loopback, or a NIC without
+			scatter-gather), where MSG_ZEROCOPY only adds the completion overhead
+	and for a single batch when the kernel is out of option memory for notifications (ENOBUFS).
+*/
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#define ADC_MSG_ZEROCOPY_PROBE 32 // completions to see before giving up on a socket that only ever copies
+#define ADC_ZEROCOPY_DRAIN_MS 1000 // how long a finished stream waits for outstanding completions
 
-int AdcLoggerTerminate = 0;
+// a batch of blocks handed to the kernel; batches are released in send order, whatever order they complete in
+typedef struct
+{
+	size_t first; // Blocks position
+	int count;
+	__u32 id;  // first MSG_ZEROCOPY send counter value used, if ids
+	__u32 ids; // MSG_ZEROCOPY sendmsg()s that took part (more than one only after a short send)
+	__u32 idsDone;
+	bool bCopied; // a completion said the kernel copied the data after all
+} TAdcInFlight;
 
-void *log_main(void *arg)
+struct TAdcSubscriber
 {
-	Trace("Thread started");
-	AdcLogTimeout.tv_sec = 1;
-	int conn = *(int *)arg;
-	int ring_read_index = 0;
+	TAdcStreamSession *session;
+	int conn;
+	TAdcLagPolicy policy;
+	int maxLag; // blocks
+	pthread_t thread;
+	std::atomic<size_t> next{0};	 // next Blocks position to send; the acquisition moves it past blocks it drops
+	std::atomic<size_t> released{0}; // finished with every block before this position
+	std::atomic<size_t> sending{SIZE_MAX}; // oldest block handed to the kernel and not yet finished with, or SIZE_MAX
+	std::atomic<bool> bTerminate{false};
+	bool bPeer = false; // conn is an AdcDatagramPeers socket, Claim()ed for this subscription
+	std::atomic<__u64> blocksDropped{0};
+
+	// sender thread only
+	__u64 bytesSent = 0;
+	int batchBlocks;
+	std::deque<TAdcInFlight> inFlight;
+	bool bMsgZeroCopy = false;
+	__u32 zcNextId = 0;
+	int zcProbed = 0, zcProbeHits = 0;
+	__u64 blocksSent = 0;
+
+	// UDP subscribers: TAdcDatagramHeader state, and sendmmsg() arrays reused from batch to batch
+	bool bDatagram = false;
+	int samplesPerDatagram;
+	__u32 sequence = 0;
+	__u8 firstChannel, lastChannel;
+	std::vector<TAdcDatagramHeader> headers;
+	std::vector<struct iovec> iovs;
+	std::vector<struct mmsghdr> msgs;
+};
 
-	while (! AdcLoggerTerminate)
+void TAdcStreamSession::retireInFlight(TAdcSubscriber &s)
+{
+	bool bRetired = false;
+	while (!s.inFlight.empty() && (s.inFlight.front().idsDone == s.inFlight.front().ids))
 	{
-		clock_gettime(CLOCK_REALTIME, &AdcLogTimeout);
-		AdcLogTimeout.tv_sec++;
-		if (-1 == sem_timedwait(&full, &AdcLogTimeout)) // TODO: check for other Errors
+		TAdcInFlight &sent = s.inFlight.front();
+		if (sent.ids)
 		{
-			if (errno == ETIMEDOUT)
+			(sent.bCopied ? Stats.sendsKernelCopied : Stats.sendsMsgZeroCopy)++;
+			if (s.zcProbed < ADC_MSG_ZEROCOPY_PROBE)
+			{
+				s.zcProbed++;
+				s.zcProbeHits += !sent.bCopied;
+				if (s.bMsgZeroCopy && (s.zcProbed == ADC_MSG_ZEROCOPY_PROBE) && (s.zcProbeHits == 0))
+				{
+					Log("ADC stream: kernel copies every MSG_ZEROCOPY send on ConnectionID " + std::to_string(s.conn) +
+						"; using plain send()");
+					s.bMsgZeroCopy = false;
+				}
+			}
+		}
+		s.inFlight.pop_front();
+		bRetired = true;
+	}
+	if (!bRetired)
+		return;
+	s.sending = s.inFlight.empty() ? SIZE_MAX : s.inFlight.front().first;
+	// blocks the acquisition dropped for us, between batches, are finished with too
+	s.released = s.inFlight.empty() ? s.next.load() : s.inFlight.front().first;
+	std::lock_guard<std::mutex> lock(SubscriberLock);
+	retire();
+}
+
+// reads MSG_ZEROCOPY completions off the error queue and releases every batch, oldest first, the kernel is done with
+void TAdcStreamSession::reapZeroCopy(TAdcSubscriber &s)
+{
+	for (;;)
+	{
+		char control[128];
+		struct msghdr msg = {};
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(s.conn, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break; // EAGAIN: nothing (more) queued
+
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if (!(((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) ||
+				  ((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_RECVERR))))
 				continue;
-			Error("Unexpected error from sem_timedwait(), errno: " + std::to_string(errno) + ", " + strerror(errno));
-			break;
+			struct sock_extended_err *err = (struct sock_extended_err *)CMSG_DATA(cm);
+			if ((err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) || (err->ee_errno != 0))
+				continue;
+			// one notification covers the inclusive range of send counters [ee_info, ee_data]
+			__u32 span = err->ee_data - err->ee_info;
+			for (auto &sent : s.inFlight)
+				for (__u32 i = 0; i < sent.ids; i++)
+					if (sent.id + i - err->ee_info <= span)
+					{
+						sent.idsDone++;
+						sent.bCopied |= err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+					}
+		}
+	}
+	retireInFlight(s);
+}
+
+// sends count blocks starting at Blocks position first in as few sendmsg()s as it takes, with MSG_ZEROCOPY while
+// that's working; the blocks are released together once the kernel is done with them.  Returns bytes sent, or -1.
+ssize_t TAdcStreamSession::sendBlocks(TAdcSubscriber &s, size_t first, int count)
+{
+	// one iovec per run of blocks that are contiguous in memory: consecutive DMA slots, up to the end of the ring
+	struct iovec iov[RING_BUFFER_SLOTS];
+	int iovcnt = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const __u8 *data = Blocks.slot(first + i).data;
+		if (iovcnt && ((const __u8 *)iov[iovcnt - 1].iov_base + iov[iovcnt - 1].iov_len == data))
+			iov[iovcnt - 1].iov_len += BYTES_PER_TRANSFER;
+		else
+			iov[iovcnt++] = {(void *)data, BYTES_PER_TRANSFER};
+	}
+
+	s.inFlight.push_back({first, count, s.zcNextId, 0, 0, false});
+	if (s.inFlight.size() == 1)
+		s.sending = first;
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	ssize_t total = 0, sent = 0;
+	while (msg.msg_iovlen)
+	{
+		sent = -1;
+		if (s.bMsgZeroCopy)
+		{
+			sent = sendmsg(s.conn, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY);
+			if (sent >= 0)
+			{
+				s.inFlight.back().ids++;
+				s.zcNextId++; // the kernel numbers only the MSG_ZEROCOPY sends that succeed
+			}
+			else if (errno == EFAULT)
+			{
+				Log("ADC stream: MSG_ZEROCOPY can't pin the block memory; using plain send()");
+				s.bMsgZeroCopy = false;
+			}
+			else if (errno != ENOBUFS)
+				break;
+		}
+		if (sent < 0)
+		{
+			sent = sendmsg(s.conn, &msg, MSG_NOSIGNAL);
+			if (sent < 0)
+				break;
+			Stats.sendsPlain++;
+		}
+		total += sent;
+
+		// a short send (signal, or the peer went away): step past what went out and send the rest
+		while (msg.msg_iovlen && ((size_t)sent >= msg.msg_iov->iov_len))
+		{
+			sent -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen)
+		{
+			msg.msg_iov->iov_base = (__u8 *)msg.msg_iov->iov_base + sent;
+			msg.msg_iov->iov_len -= sent;
+		}
+	}
+
+	s.bytesSent += total;
+	if (sent < 0)
+		return -1;
+	s.blocksSent += count;
+	for (int i = 0; i < count; i++)
+		((Blocks.slot(first + i).dmaSlot >= 0) ? Stats.bytesZeroCopy : Stats.bytesCopied) +=
+			BYTES_PER_TRANSFER;
+	Stats.blocksSent += count;
+	Stats.sendBatches++;
+	return total;
+}
+
+/*
+	UDP: every block goes out as datagrams of a TAdcDatagramHeader plus as many samples as fit the path MTU (re-read
+	each batch, so it follows PMTU discovery), ADC_DATAGRAMS_PER_CALL at a time with sendmmsg().  The samples are sent
+	straight from the block; the kernel has copied them by the time sendmmsg() returns, so the batch is done with.
+*/
+#define ADC_DATAGRAMS_PER_CALL 1024 // UIO_MAXIOV: sendmmsg()'s limit
+#define ADC_DATAGRAM_OVERHEAD 48	// IPv6 + UDP headers
+
+static int samplesPerDatagram(int conn)
+{
+	int mtu = 0;
+	socklen_t size = sizeof(mtu);
+	if (getsockopt(conn, IPPROTO_IPV6, IPV6_MTU, &mtu, &size) && getsockopt(conn, IPPROTO_IP, IP_MTU, &mtu, &size))
+		mtu = 1500;
+	int samples = (mtu - ADC_DATAGRAM_OVERHEAD - (int)sizeof(TAdcDatagramHeader)) / (int)sizeof(__u32);
+	return std::max(1, std::min(samples, SAMPLES_PER_TRANSFER));
+}
+
+// sends count blocks starting at Blocks position first as datagrams; returns bytes sent (headers included), or -1
+// once the peer is gone
+ssize_t TAdcStreamSession::sendDatagrams(TAdcSubscriber &s, size_t first, int count)
+{
+	s.samplesPerDatagram = samplesPerDatagram(s.conn);
+	int perBlock = (SAMPLES_PER_TRANSFER + s.samplesPerDatagram - 1) / s.samplesPerDatagram;
+	size_t total = (size_t)count * perBlock;
+	s.headers.resize(total);
+	s.iovs.resize(2 * total);
+	s.msgs.resize(total);
+
+	__u32 dropped = s.blocksDropped;
+	size_t n = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const __u32 *samples = (const __u32 *)Blocks.slot(first + i).data;
+		for (int index = 0; index < SAMPLES_PER_TRANSFER; index += s.samplesPerDatagram, n++)
+		{
+			TAdcDatagramHeader &header = s.headers[n];
+			header.sequence = s.sequence++;
+			header.block = first + i;
+			header.sampleOffset = (__u64)(first + i) * SAMPLES_PER_TRANSFER + index;
+			header.blocksDropped = dropped;
+			header.samples = std::min(s.samplesPerDatagram, SAMPLES_PER_TRANSFER - index);
+			header.firstChannel = s.firstChannel;
+			header.lastChannel = s.lastChannel;
+			s.iovs[2 * n] = {&header, sizeof(header)};
+			s.iovs[2 * n + 1] = {(void *)(samples + index), header.samples * sizeof(__u32)};
+			s.msgs[n].msg_hdr = {};
+			s.msgs[n].msg_hdr.msg_iov = &s.iovs[2 * n];
+			s.msgs[n].msg_hdr.msg_iovlen = 2;
 		}
-		pthread_mutex_lock(&mutex);
+	}
 
-		ssize_t sent = send(conn, ring_buffer[ring_read_index], (sizeof(uint32_t) * SAMPLES_PER_TRANSFER), MSG_NOSIGNAL);
+	s.inFlight.push_back({first, count, 0, 0, 0, false}); // nothing for the kernel to hold on to
+	if (s.inFlight.size() == 1)
+		s.sending = first;
+	ssize_t bytes = 0;
+	for (size_t done = 0; done < total;)
+	{
+		int sent = sendmmsg(s.conn, &s.msgs[done], std::min(total - done, (size_t)ADC_DATAGRAMS_PER_CALL), 0);
 		if (sent < 0)
-			if (errno == EPIPE)
+		{
+			if (errno == EINTR)
+				continue;
+			if ((errno == ECONNREFUSED) || (errno == EBADF) || (errno == ENOTCONN) || (errno == EPIPE))
+				return -1; // nobody listening any more, or shut down by waitForSenders()
+			Stats.datagramsFailed++; // ENOBUFS, EMSGSIZE and the like: that one is lost, the rest can go
+			sent = 1;
+		}
+		else
+		{
+			Stats.datagramsSent += sent;
+			for (int i = 0; i < sent; i++)
+				bytes += s.msgs[done + i].msg_len;
+		}
+		done += sent;
+	}
+
+	s.bytesSent += bytes;
+	s.blocksSent += count;
+	for (int i = 0; i < count; i++)
+		((Blocks.slot(first + i).dmaSlot >= 0) ? Stats.bytesZeroCopy : Stats.bytesCopied) +=
+			BYTES_PER_TRANSFER;
+	Stats.blocksSent += count;
+	Stats.sendBatches++;
+	return bytes;
+}
+
+// waits up to timeoutMs for the kernel to report more completions; false if the connection is gone
+bool TAdcStreamSession::waitZeroCopy(TAdcSubscriber &s, int timeoutMs)
+{
+	struct pollfd pfd = {s.conn, 0, 0}; // POLLERR (error queue not empty) and POLLHUP are always reported
+	if ((poll(&pfd, 1, timeoutMs) > 0) && (pfd.revents & POLLHUP))
+		return false;
+	reapZeroCopy(s);
+	return true;
+}
+
+void *TAdcStreamSession::SenderThread(void *arg)
+{
+	TAdcSubscriber *s = (TAdcSubscriber *)arg;
+	pthread_setname_np(pthread_self(), "adc-send"); // so top -H, and bench/adc_stream, can tell it apart
+	s->session->sendTo(*s);
+	return nullptr;
+}
+
+void TAdcStreamSession::sendTo(TAdcSubscriber &s)
+{
+	Trace("Thread started, ConnectionID: " + std::to_string(s.conn));
+	const struct timespec timeout = {1, 0};
+
+	int type = SOCK_STREAM;
+	socklen_t size = sizeof(type);
+	getsockopt(s.conn, SOL_SOCKET, SO_TYPE, &type, &size);
+	s.bDatagram = (type == SOCK_DGRAM);
+	if (s.bDatagram)
+	{
+		s.samplesPerDatagram = samplesPerDatagram(s.conn);
+		s.firstChannel = Board->In8(ofsAdcStartChannel) & 0x7F;
+		s.lastChannel = Board->In8(ofsAdcStopChannel) & 0x7F;
+		Log("ADC stream to ConnectionID " + std::to_string(s.conn) + " over UDP, " +
+			std::to_string(s.samplesPerDatagram) + " samples per datagram");
+	}
+
+	const char *msgZeroCopy = getenv("AIOENETD_ADC_MSG_ZEROCOPY");
+	int one = 1;
+	s.bMsgZeroCopy = !s.bDatagram && (msgZeroCopy != nullptr) && !strcmp(msgZeroCopy, "1");
+	if (s.bMsgZeroCopy && setsockopt(s.conn, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)))
+	{
+		Log("ADC stream: SO_ZEROCOPY not supported (" + std::string(strerror(errno)) + "); using plain send()");
+		s.bMsgZeroCopy = false;
+	}
+	const char *batchBytes = getenv("AIOENETD_ADC_BATCH_BYTES");
+	s.batchBlocks = (batchBytes ? atoi(batchBytes) : ADC_BATCH_BYTES) / BYTES_PER_TRANSFER;
+	s.batchBlocks = std::max(1, std::min(s.batchBlocks, RING_BUFFER_SLOTS));
+
+	while (!s.bTerminate)
+	{
+		size_t first = s.next;
+		// blocks sent but still referenced by the kernel count against MaxLag too
+		size_t held = s.inFlight.empty() ? 0 : first - s.inFlight.front().first;
+		size_t ready;
+		if (!s.inFlight.empty())
+		{
+			// completions free blocks, so don't sleep on the ring without them
+			reapZeroCopy(s);
+			ready = Blocks.readable(first);
+			if (!ready || (held >= (size_t)s.maxLag))
 			{
-				AdcStreamTerminate = 1;
-				apci_cancel_irq(apci, 1);
-				AdcStreamingConnection = -1;
-				AdcWorkerThreadID = -1;
-				AdcLoggerTerminate = 1;
+				if (!waitZeroCopy(s, 1))
+					break;
 				continue;
 			}
-		pthread_mutex_unlock(&mutex);
-		sem_post(&empty);
-		Trace("Sent ADC Data "+std::to_string(sent)+" bytes, on ConnectionID: "+std::to_string(conn));
+		}
+		else if (!(ready = Blocks.readable(first)))
+		{
+			if (s.released < first)
+			{
+				// the acquisition dropped blocks for us while we had none in flight; hand them back before sleeping,
+				// or with the ring full of them it can't publish the block that would wake us
+				s.released = first;
+				std::lock_guard<std::mutex> lock(SubscriberLock);
+				retire();
+			}
+			if (!(ready = Blocks.waitReadable(first, &timeout)))
+			{
+				if (Blocks.stopped())
+					break;
+				continue; // timed out, or woken to check bTerminate
+			}
+		}
+		// every block already waiting, up to the batch budget
+		int count = std::min({ready, (size_t)s.batchBlocks, s.maxLag - held});
+		if (!s.next.compare_exchange_strong(first, first + count))
+			continue; // the acquisition just dropped blocks ahead of us
+
+		ssize_t sent = s.bDatagram ? sendDatagrams(s, first, count) : sendBlocks(s, first, count);
+		retireInFlight(s);
+		if (sent < 0)
+		{
+			if ((errno != EPIPE) && (errno != ECONNREFUSED))
+				Error("ADC stream send failed on ConnectionID " + std::to_string(s.conn) + ": " + strerror(errno));
+			break;
+		}
+		Trace("Sent ADC Data " + std::to_string(sent) + " bytes, on ConnectionID: " + std::to_string(s.conn));
+	}
+
+	// blocks the kernel still references: give it a moment, then let them go regardless
+	for (int ms = 0; !s.inFlight.empty() && (ms < ADC_ZEROCOPY_DRAIN_MS); ms++)
+		if (!waitZeroCopy(s, 1))
+			break;
+	for (auto &sent : s.inFlight)
+		sent.idsDone = sent.ids;
+	retireInFlight(s);
+
+	{
+		std::lock_guard<std::mutex> lock(SubscriberLock);
+		leave(s);
+	}
+	Log("ADC stream to ConnectionID " + std::to_string(s.conn) + " ended: " + std::to_string(s.bytesSent) +
+		" bytes sent, " + std::to_string(s.blocksSent) + " blocks sent, " + std::to_string(s.blocksDropped) +
+		" blocks dropped");
+	if (s.bPeer)
+		AdcDatagramPeers.Release(s.conn);
+	delete &s;
+}
+#pragma endregion
+
+#pragma region subscribers
+int TAdcStreamSession::find(int conn)
+{
+	for (int i = 0; i < ADC_MAX_SUBSCRIBERS; i++)
+		if (Subscribers[i] && (Subscribers[i]->conn == conn))
+			return i;
+	return -1;
+}
+
+// hands every block all subscribers are finished with back to the acquisition, and leased DMA slots to the card
+void TAdcStreamSession::retire()
+{
+	size_t upTo = Blocks.published();
+	for (auto s : Subscribers)
+		if (s)
+			upTo = std::min(upTo, s->released.load());
+	if (upTo <= Retired)
+		return;
+
+	int dmaSlots[RING_BUFFER_SLOTS];
+	int dmaCount = 0;
+	for (size_t pos = Retired; pos < upTo; pos++)
+		if (Blocks.slot(pos).dmaSlot >= 0)
+			dmaSlots[dmaCount++] = Blocks.slot(pos).dmaSlot;
+	if (dmaCount)
+		releaseDmaSlots(dmaSlots, dmaCount);
+	Blocks.release(upTo - Retired);
+	Retired = upTo;
+}
+
+// applies each subscriber's TAdcLagPolicy once it is more than MaxLag blocks behind
+void TAdcStreamSession::enforceLag()
+{
+	size_t head = Blocks.published();
+	for (auto s : Subscribers)
+	{
+		if (!s || (head - s->released <= (size_t)s->maxLag))
+			continue;
+		if (s->policy == lagDisconnect)
+		{
+			if (!s->bTerminate.exchange(true))
+			{
+				Log("ADC stream: ConnectionID " + std::to_string(s->conn) + " fell too far behind; disconnecting it");
+				shutdown(s->conn, SHUT_RDWR); // ends a send() it is blocked in
+			}
+			continue;
+		}
+		// lagDropOldest: skip whatever it hasn't started sending; what it has, it finishes
+		size_t next = s->next;
+		if ((next < head) && s->next.compare_exchange_strong(next, head))
+		{
+			s->blocksDropped += head - next;
+			Stats.blocksDropped += head - next;
+		}
+		// ...unless what it has is itself more than MaxLag behind: its send() is stuck (a peer whose window stays
+		// shut), pinning those blocks and their DMA slots where no dropping can free them, so cut it off
+		size_t sending = s->sending;
+		if ((sending != SIZE_MAX) && (head - sending > (size_t)s->maxLag) && !s->bTerminate.exchange(true))
+		{
+			Log("ADC stream: ConnectionID " + std::to_string(s->conn) + " stuck sending; disconnecting it");
+			shutdown(s->conn, SHUT_RDWR);
+		}
+	}
+}
 
-		ring_read_index++;
-		ring_read_index %= RING_BUFFER_SLOTS;
+// a sender's last touch of the session: once every subscriber has left, the session can unmap the DMA buffer and
+// be destroyed (see waitForSenders())
+void TAdcStreamSession::leave(TAdcSubscriber &s)
+{
+	Subscribers[find(s.conn)] = nullptr;
+	SubscriberCount--;
+	retire();
+	if (SubscriberCount == 0)
+		SubscribersLeft.notify_all(); // under SubscriberLock, so the waiter can't destroy it before this returns
+	if ((SubscriberCount == 0) && !bStopping)
+	{
+		Trace("Last ADC subscriber left; stopping the acquisition");
+		bStopping = true;
+		Board->CancelWaitForIRQ();
+	}
+}
+
+int TAdcStreamSession::Subscribe(int conn, TAdcLagPolicy policy, int maxLag)
+{
+	std::lock_guard<std::mutex> control(ControlLock);
+	TAdcSubscriber *s = new TAdcSubscriber;
+	s->session = this;
+	s->conn = conn;
+	s->policy = policy;
+	s->maxLag = std::max(1, std::min(maxLag, ADC_MAX_MAX_LAG));
+	s->bPeer = AdcDatagramPeers.Claim(conn);
+	auto refuse = [s](int status) {
+		if (s->bPeer)
+			AdcDatagramPeers.Release(s->conn);
+		delete s;
+		return status;
 	};
-	AdcLoggerThreadID = -1;
 
-	Trace("Thread ended");
+	for (;;)
+	{
+		if (bWorker && bStopping)
+		{
+			pthread_join(Worker, NULL); // an acquisition still winding down
+			bWorker = false;
+		}
+		std::lock_guard<std::mutex> lock(SubscriberLock);
+		if (bWorker && bStopping)
+			continue; // the last subscriber just left
+		if (find(conn) >= 0)
+			return refuse(-EEXIST);
+		int slot = -1;
+		for (int i = 0; (slot < 0) && (i < ADC_MAX_SUBSCRIBERS); i++)
+			if (!Subscribers[i])
+				slot = i;
+		if (slot < 0)
+			return refuse(-EBUSY);
+		if (!bWorker)
+		{
+			Blocks.Reset();
+			Retired = 0;
+			bStopping = false;
+		}
+		s->next = s->released = Blocks.published();
+		Subscribers[slot] = s;
+		SubscriberCount++;
+		break;
+	}
+	Trace("ADC stream subscriber added, ConnectionID: " + std::to_string(conn) + ", " + std::to_string(SubscriberCount) +
+		  " subscribed");
+
+	if (pthread_create(&s->thread, NULL, &SenderThread, s))
+	{
+		std::lock_guard<std::mutex> lock(SubscriberLock);
+		leave(*s);
+		return refuse(-EAGAIN);
+	}
+	pthread_detach(s->thread);
+
+	if (bWorker)
+		return 0;
+	int status = Board->DmaTransferSize(RING_BUFFER_SLOTS, BYTES_PER_TRANSFER);
+	if (status == 0)
+		status = pthread_create(&Worker, NULL, &AcquisitionThread, this) ? -EAGAIN : 0;
+	if (status)
+	{
+		Error("Error starting the ADC acquisition: " + std::to_string(status));
+		std::lock_guard<std::mutex> lock(SubscriberLock);
+		s->bTerminate = true;
+		Blocks.Stop();
+		return status;
+	}
+	bWorker = true;
+	Board->StartDma();
 	return 0;
 }
 
-void *worker_main(void *arg)
+int TAdcStreamSession::Unsubscribe(int conn)
+{
+	std::lock_guard<std::mutex> lock(SubscriberLock);
+	int i = find(conn);
+	if (i < 0)
+		return -ENOENT;
+	Subscribers[i]->bTerminate = true;
+	Blocks.WakeReaders();
+	return 0;
+}
+
+void TAdcStreamSession::Stop()
+{
+	std::lock_guard<std::mutex> control(ControlLock);
+	{
+		std::lock_guard<std::mutex> lock(SubscriberLock);
+		for (auto s : Subscribers)
+			if (s)
+				s->bTerminate = true;
+		if (!bWorker || bStopping)
+			return;
+		bStopping = true;
+	}
+	Board->CancelWaitForIRQ();
+	Blocks.Stop();
+}
+
+TAdcStreamSession::~TAdcStreamSession()
+{
+	Stop();
+	{
+		std::lock_guard<std::mutex> control(ControlLock);
+		if (bWorker)
+			pthread_join(Worker, NULL);
+		bWorker = false;
+	}
+	waitForSenders(); // only any left if the acquisition never started
+	delete[] CopyBuffer;
+}
+
+// gives the senders ADC_SUBSCRIBER_EXIT_MS to finish, then shuts down the sockets of any still sending -- ending a
+// send() they are blocked in -- and waits for them all to leave()
+void TAdcStreamSession::waitForSenders()
+{
+	std::unique_lock<std::mutex> lock(SubscriberLock);
+	Blocks.WakeReaders();
+	if (SubscribersLeft.wait_for(lock, std::chrono::milliseconds(ADC_SUBSCRIBER_EXIT_MS),
+								 [this] { return SubscriberCount == 0; }))
+		return;
+	for (auto s : Subscribers)
+		if (s)
+		{
+			Error("ADC stream to ConnectionID " + std::to_string(s->conn) + " still sending; cutting it off");
+			s->bTerminate = true;
+			shutdown(s->conn, SHUT_RDWR);
+		}
+	SubscribersLeft.wait(lock, [this] { return SubscriberCount == 0; });
+}
+
+int TAdcStreamSession::ActiveSubscribers()
+{
+	std::lock_guard<std::mutex> lock(SubscriberLock);
+	return SubscriberCount;
+}
+#pragma endregion
+
+#pragma region UDP peers
+TAdcDatagramPeers AdcDatagramPeers;
+
+int TAdcDatagramPeers::find(int conn)
+{
+	for (int i = 0; i < ADC_MAX_DATAGRAM_PEERS; i++)
+		if ((Peers[i].conn >= 0) && (Peers[i].conn == conn))
+			return i;
+	return -1;
+}
+
+int TAdcDatagramPeers::Hello(const struct sockaddr_in6 &peer, const struct sockaddr_in6 &local, void (*answer)(int conn))
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	int free = -1;
+	for (int i = 0; i < ADC_MAX_DATAGRAM_PEERS; i++)
+	{
+		TPeer &p = Peers[i];
+		if (p.conn < 0)
+		{
+			if (free < 0)
+				free = i;
+			continue;
+		}
+		if ((p.addr.sin6_port == peer.sin6_port) && !memcmp(&p.addr.sin6_addr, &peer.sin6_addr, sizeof(peer.sin6_addr)) &&
+			(p.addr.sin6_scope_id == peer.sin6_scope_id))
+		{
+			p.lastHello = std::chrono::steady_clock::now(); // sent before its socket was connected
+			answer(p.conn);
+			return p.conn;
+		}
+	}
+	if (free < 0)
+	{
+		Trace("ADC datagram hello ignored: all " + std::to_string(ADC_MAX_DATAGRAM_PEERS) + " peer sockets in use");
+		return -1;
+	}
+
+	// shares the listener's port, so the client hears back from the port it wrote to
+	int opt = 1;
+	int conn = socket(AF_INET6, SOCK_DGRAM, 0);
+	if ((conn < 0) || setsockopt(conn, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+		bind(conn, (struct sockaddr *)&local, sizeof(local)) || connect(conn, (struct sockaddr *)&peer, sizeof(peer)))
+	{
+		Error("ADC datagram client setup failed: " + std::string(strerror(errno)));
+		if (conn >= 0)
+			close(conn);
+		return -1;
+	}
+	Peers[free].addr = peer;
+	Peers[free].conn = conn;
+	Peers[free].subscriptions = 0;
+	Peers[free].lastHello = std::chrono::steady_clock::now();
+	answer(conn);
+	return conn;
+}
+
+void TAdcDatagramPeers::Rehello(int conn, void (*answer)(int conn))
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	int i = find(conn);
+	if (i < 0)
+		return; // closed since it was polled
+	__u8 buffer[64];
+	bool bHello = false;
+	for (int n = 0; (n < ADC_MAX_DATAGRAM_PEERS) && (recv(conn, buffer, sizeof(buffer), MSG_DONTWAIT) >= 0); n++)
+		bHello = true; // any number of them get one answer
+	if (!bHello)
+		return; // an ICMP error, say: nothing to answer
+	Peers[i].lastHello = std::chrono::steady_clock::now();
+	answer(conn);
+}
+
+int TAdcDatagramPeers::Sockets(struct pollfd *fds)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	int count = 0;
+	for (auto &p : Peers)
+		if (p.conn >= 0)
+			fds[count++] = {p.conn, POLLIN, 0};
+	return count;
+}
+
+void TAdcDatagramPeers::Sweep()
+{
+	auto idleSince = std::chrono::steady_clock::now() - std::chrono::seconds(ADC_DATAGRAM_IDLE_S);
+	std::lock_guard<std::mutex> lock(Lock);
+	for (auto &p : Peers)
+		if ((p.conn >= 0) && (p.subscriptions == 0) && (p.lastHello <= idleSince))
+		{
+			Trace("ADC datagram peer on ConnectionID " + std::to_string(p.conn) + " never subscribed; closing it");
+			close(p.conn);
+			p.conn = -1;
+		}
+}
+
+bool TAdcDatagramPeers::Claim(int conn)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	int i = find(conn);
+	if (i < 0)
+		return false;
+	Peers[i].subscriptions++;
+	return true;
+}
+
+void TAdcDatagramPeers::Release(int conn)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	int i = find(conn);
+	if ((i < 0) || (--Peers[i].subscriptions > 0))
+		return;
+	close(conn);
+	Peers[i].conn = -1;
+}
+#pragma endregion
+
+#pragma region acquisition
+void *TAdcStreamSession::AcquisitionThread(void *arg)
+{
+	pthread_setname_np(pthread_self(), "adc-acquire");
+	((TAdcStreamSession *)arg)->acquire();
+	return nullptr;
+}
+
+void TAdcStreamSession::acquire()
 {
 	Trace("Thread started");
-	int *conn_fd = (int *)arg;
 	int num_slots, first_slot, data_discarded, status = 0;
+	const char *zeroCopy = getenv("AIOENETD_ADC_ZEROCOPY");
+	bool bZeroCopy = (zeroCopy == nullptr) || strcmp(zeroCopy, "0");
+	const struct timespec roomTimeout = {0, 10000000}; // re-apply lag policies this often while the ring is full
 
-	status = sem_init(&empty, 0, 255);
-	status |= sem_init(&full, 0, 0);
-	status |= pthread_mutex_init(&mutex, NULL);
-	if (status)
 	{
-		Error("Mutex failed");
-		return (void *)(size_t)status;
+		std::lock_guard<std::mutex> lock(LeaseLock);
+		memset(DmaReleased, 0, sizeof(DmaReleased));
+		DmaOldest = DmaHeld = DmaLeased = 0;
 	}
+	if (!CopyBuffer)
+		CopyBuffer = new __u32[RING_BUFFER_SLOTS][SAMPLES_PER_TRANSFER];
+	Stats.bytesZeroCopy = Stats.bytesCopied = 0;
+	Stats.sendsMsgZeroCopy = Stats.sendsKernelCopied = Stats.sendsPlain = 0;
+	Stats.blocksSent = Stats.sendBatches = Stats.blocksDropped = 0;
+	Stats.datagramsSent = Stats.datagramsFailed = 0;
 
-	void *mmap_addr = (void *)mmap(NULL, DMA_BUFF_SIZE, PROT_READ, MAP_SHARED, apci, 0);
-	if (mmap_addr == NULL)
-	{
+	DmaBuffer = Board->MapDmaBuffer(DMA_BUFF_SIZE);
+	if (DmaBuffer == NULL)
 		Error("mmap failed");
-		return (void *)-1;
-	}
 	try
 	{
-		if (AdcLoggerThreadID == -1){
-			AdcLoggerTerminate = 0;
-			Trace("No Logger Thread Found: Starting Logger thread.");
-			AdcLoggerThreadID = pthread_create(&logger_thread, NULL, &log_main, conn_fd);
-		}
-		while (1)
+		while (DmaBuffer && !bStopping)
 		{
-			status = apci_dma_data_ready(apci, 1, &first_slot, &num_slots, &data_discarded);
+			// slots the card reports ready include those we already hold; only the ones after them are new
+			int held;
+			{
+				std::lock_guard<std::mutex> lock(LeaseLock);
+				status = Board->DmaDataReady(&first_slot, &num_slots, &data_discarded);
+				held = DmaHeld;
+				if (num_slots > held)
+					DmaHeld = num_slots;
+			}
 			if ((data_discarded != 0) || status)
 			{
 				Error("first_slot: "+std::to_string(first_slot)+ "num_slots:" +
 				       std::to_string(num_slots)+ "+data_discarded:"+std::to_string(data_discarded) +"; status: " + std::to_string(status));
 			}
 
-			if (num_slots == 0) // Worker Thread: No data pending; Waiting for IRQ
+			if (num_slots <= held) // Worker Thread: No data pending; Waiting for IRQ
 			{
 				//Log("no data yet, blocking");
-				status = apci_wait_for_irq(apci, 1); // thread blocking
+				status = Board->WaitForIRQ(); // thread blocking
 				if (status)
 				{
 					status = errno;
@@ -145,38 +903,101 @@ void *worker_main(void *arg)
 						Error("  Worker Thread: Error waiting for IRQ; status: " + std::to_string(status) + ", " + strerror(status));
 					else
 						Trace("  Thread canceled.");
-
-					AdcStreamTerminate = 1;
-					AdcLoggerTerminate = 1;
 					break;
 				}
 				continue;
 			}
 			Trace("Taking ADC Data block(s)");
-			for (int i = 0; i < num_slots; i++)
+			int i = held;
+			while ((i < num_slots) && !bStopping)
 			{
-				sem_wait(&empty);
-				pthread_mutex_lock(&mutex);
-				memcpy(ring_buffer[(first_slot + i) % RING_BUFFER_SLOTS], ((__u8 *)mmap_addr + (BYTES_PER_TRANSFER * ((first_slot + i) % RING_BUFFER_SLOTS))),
-					   BYTES_PER_TRANSFER);
-				pthread_mutex_unlock(&mutex);
-				sem_post(&full);
-				apci_dma_data_done(apci, 1, 1);
+				size_t room = Blocks.writable();
+				if (!room)
+				{
+					// full: some subscriber is behind; its lag policy makes room
+					{
+						std::lock_guard<std::mutex> lock(SubscriberLock);
+						enforceLag();
+					}
+					room = Blocks.waitWritable(&roomTimeout);
+					continue;
+				}
+				int count = std::min(room, (size_t)(num_slots - i));
+				size_t pos = Blocks.writePosition();
+				int leased, leases = 0;
+				{
+					std::lock_guard<std::mutex> lock(LeaseLock);
+					leased = DmaLeased;
+				}
+				for (int n = 0; n < count; n++, i++, pos++)
+				{
+					int dmaSlot = (first_slot + i) % RING_BUFFER_SLOTS;
+					const __u8 *slotData = (__u8 *)DmaBuffer + (BYTES_PER_TRANSFER * dmaSlot);
+					TAdcBlock &block = Blocks.slot(pos);
+					if (bZeroCopy && (leased + leases < ADC_LEASE_HIGH_WATER))
+					{
+						block.data = slotData;
+						block.dmaSlot = dmaSlot;
+						leases++;
+					}
+					else
+					{
+						__u32 *copy = CopyBuffer[pos % RING_BUFFER_SLOTS];
+						memcpy(copy, slotData, BYTES_PER_TRANSFER);
+						block.data = (const __u8 *)copy;
+						block.dmaSlot = -1;
+						releaseCopiedDmaSlot(dmaSlot);
+					}
+				}
+				if (leases)
+				{
+					std::lock_guard<std::mutex> lock(LeaseLock); // before publishing, which lets them be released
+					DmaLeased += leases;
+				}
+				Blocks.publish(count);
+				{
+					std::lock_guard<std::mutex> lock(SubscriberLock);
+					enforceLag();
+					retire(); // only does anything with no subscribers left
+				}
 			}
 		}
 		Trace("Thread ended");
 	}
-	catch(std::exception e)
+	catch (const std::exception &e)
 	{
 		Error(e.what());
 	}
-	Trace("Setting AdcStreamingConnection to idle");
-	apci_write8(apci, 1, BAR_REGISTER, 0x12, 0); // turn off ADC start modes
-	// pthread_cancel(logger_thread);
-	pthread_join(logger_thread, NULL);
-	pthread_mutex_destroy(&mutex);
-	sem_destroy(&full);
-	sem_destroy(&empty);
-	Trace("ADC Log Thread exiting.");
-	return 0;
-}
\ No newline at end of file
+	Trace("Setting ADC acquisition idle");
+	{
+		std::lock_guard<std::mutex> lock(SubscriberLock);
+		bStopping = true;
+		for (auto s : Subscribers)
+			if (s)
+				s->bTerminate = true;
+	}
+	Blocks.Stop();
+	Board->Out8(ofsAdcTriggerOptions, 0); // turn off ADC start modes
+
+	// senders may still be sending from the DMA buffer; none may be left before it is unmapped
+	waitForSenders();
+	if (DmaBuffer)
+		Board->UnmapDmaBuffer(DmaBuffer, DMA_BUFF_SIZE);
+	DmaBuffer = nullptr;
+	Log("ADC stream on board " + std::to_string(Board->Index) + " ended: " + std::to_string(Stats.bytesZeroCopy) + " bytes sent zero-copy, " +
+		std::to_string(Stats.bytesCopied) + " bytes copied; " + std::to_string(Stats.blocksSent) +
+		" blocks in " + std::to_string(Stats.sendBatches) + " batches, " +
+		std::to_string(Stats.blocksDropped) + " dropped for lagging subscribers");
+	if (Stats.datagramsSent || Stats.datagramsFailed)
+		Log("ADC stream UDP: " + std::to_string(Stats.datagramsSent) + " datagrams sent, " +
+			std::to_string(Stats.datagramsFailed) + " failed");
+	__u64 zcSends = Stats.sendsMsgZeroCopy + Stats.sendsKernelCopied;
+	if (zcSends)
+		Log("ADC stream MSG_ZEROCOPY: " + std::to_string(Stats.sendsMsgZeroCopy) + " of " +
+			std::to_string(zcSends + Stats.sendsPlain) + " sends zero-copy (" +
+			std::to_string(100 * Stats.sendsMsgZeroCopy / (zcSends + Stats.sendsPlain)) + "%), " +
+			std::to_string(Stats.sendsKernelCopied) + " copied by the kernel, " +
+			std::to_string(Stats.sendsPlain) + " plain");
+	Trace("ADC acquisition thread exiting.");
+}
+#pragma endregion
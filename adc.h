@@ -2,12 +2,200 @@
 
 // ADC Streaming-related stuff for eNET-AIO Family hardware
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <poll.h>
+
+#include "eNET-types.h"
+#include "eNET-AIO16-16F.h"
+#include "spsc_ring.h"
+
 #define RING_BUFFER_SLOTS 255
 #define DMA_BUFF_SIZE (BYTES_PER_TRANSFER * RING_BUFFER_SLOTS)
-extern volatile int AdcStreamTerminate;
-void *worker_main(void *arg);
-extern pthread_t worker_thread;
-extern pthread_t logger_thread;
-extern int AdcStreamingConnection;
 
-extern int AdcWorkerThreadID;
\ No newline at end of file
+#define ADC_MAX_SUBSCRIBERS 8
+#define ADC_DEFAULT_MAX_LAG (RING_BUFFER_SLOTS / 2)	// blocks
+#define ADC_MAX_MAX_LAG (RING_BUFFER_SLOTS * 3 / 4) // leaves the acquisition room however far behind one subscriber falls
+
+// what happens to a subscriber that falls more than its MaxLag blocks behind the acquisition
+typedef enum : __u8
+{
+	lagDropOldest = 0, // skip it ahead to the newest data; it sees a gap, counted in blocksDropped.  Disconnected if
+					   // its send() is stuck on blocks more than MaxLag old
+	lagDisconnect = 1, // shut its connection down
+} TAdcLagPolicy;
+
+class TApciBoard;
+
+// per-stream counters, reset when a stream starts and logged when it ends; sums over every subscriber
+typedef struct
+{
+	std::atomic<__u64> bytesZeroCopy{0}; // sent straight out of leased DMA slots
+	std::atomic<__u64> bytesCopied{0};	 // sent from CopyBuffer[] after the copy fallback
+	// AIOENETD_ADC_MSG_ZEROCOPY=1: how each sendmsg() went; hit rate is sendsMsgZeroCopy over all three
+	std::atomic<__u64> sendsMsgZeroCopy{0};  // MSG_ZEROCOPY, and the kernel didn't copy
+	std::atomic<__u64> sendsKernelCopied{0}; // MSG_ZEROCOPY, but the kernel copied anyway
+	std::atomic<__u64> sendsPlain{0};		 // plain send(): MSG_ZEROCOPY off, or fallen back
+	std::atomic<__u64> blocksSent{0};
+	std::atomic<__u64> sendBatches{0}; // blocksSent / sendBatches is the average batch
+	std::atomic<__u64> blocksDropped{0}; // skipped by lagDropOldest subscribers
+	std::atomic<__u64> datagramsSent{0};	 // UDP subscribers
+	std::atomic<__u64> datagramsFailed{0}; // sendmmsg() refused them (ENOBUFS and the like); lost before the network
+} TAdcStreamStats;
+
+// one ADC block as the acquisition publishes it: 16 KiB of samples, either still in its DMA slot or copied out
+typedef struct
+{
+	const __u8 *data;
+	int dmaSlot; // DMA slot leased, or -1 if data points into the copy buffer
+} TAdcBlock;
+
+/*
+	A subscriber on a UDP socket gets the stream as datagrams: each one this header then `samples` u32 samples, as
+	many as fit the path MTU.  A gap in `sequence` is data lost on the way; `blocksDropped` growing is data the server
+	skipped because the subscriber fell behind (TAdcLagPolicy).  Little-endian, like the TCP protocol.
+*/
+#pragma pack(push, 1)
+typedef struct
+{
+	__u32 sequence;		 // datagram number in this subscriber's stream, from 0
+	__u32 block;		 // ADC block (16 KiB) the samples come from, counted from the start of the acquisition
+	__u64 sampleOffset;	 // first sample's index in the acquisition: block * SAMPLES_PER_TRANSFER + index in block
+	__u32 blocksDropped; // blocks skipped for this subscriber so far
+	__u16 samples;		 // u32 samples following this header
+	__u8 firstChannel;	 // ADC start/stop channel registers the acquisition is scanning
+	__u8 lastChannel;
+} TAdcDatagramHeader;
+#pragma pack(pop)
+
+#define ADC_MAX_DATAGRAM_PEERS 32
+#define ADC_DATAGRAM_IDLE_S 30 // how long a UDP peer's socket stays open after a hello if it never subscribes
+
+/*
+	The UDP subscribers' sockets: one per peer address, connected back to it, opened on the peer's first hello.  Being
+	connected, a peer's socket -- not the listener's -- receives its later hellos, so the listener polls those too
+	(Sockets()) and answers them from the same socket (Rehello()).  Each is closed when its last subscription ends, or
+	ADC_DATAGRAM_IDLE_S after its last hello if it is never subscribed, so datagrams from any number of (forged)
+	addresses hold at most ADC_MAX_DATAGRAM_PEERS descriptors.  Sockets are only read, answered or closed under Lock,
+	so none of that can reach a descriptor number already reused by another connection.
+*/
+class TAdcDatagramPeers
+{
+public:
+	// a hello from peer on the listener: opens the peer's socket, bound to local, unless it has one, and answer()s
+	// on it; -1 if it can't be opened, or all ADC_MAX_DATAGRAM_PEERS are in use
+	int Hello(const struct sockaddr_in6 &peer, const struct sockaddr_in6 &local, void (*answer)(int conn));
+	// conn has datagrams waiting: reads them and answer()s on conn, if it is still a peer's socket
+	void Rehello(int conn, void (*answer)(int conn));
+	// fills fds with every open socket, for POLLIN; returns how many (up to ADC_MAX_DATAGRAM_PEERS)
+	int Sockets(struct pollfd *fds);
+	// closes every socket with no subscription whose last hello is ADC_DATAGRAM_IDLE_S old
+	void Sweep();
+	// a subscription on conn starts: false if conn isn't a peer's socket.  Keeps Sweep() from closing it
+	bool Claim(int conn);
+	// a subscription Claim()ed on conn ends; closes conn once it was the last
+	void Release(int conn);
+
+protected:
+	int find(int conn); // Lock held
+
+	typedef struct
+	{
+		struct sockaddr_in6 addr;
+		int conn = -1; // -1: a free entry
+		int subscriptions = 0;
+		std::chrono::steady_clock::time_point lastHello;
+	} TPeer;
+
+	std::mutex Lock;
+	TPeer Peers[ADC_MAX_DATAGRAM_PEERS];
+};
+
+extern TAdcDatagramPeers AdcDatagramPeers;
+
+struct TAdcSubscriber;
+
+/*
+	One DMA acquisition, fanned out to every ADC connection subscribed to it (ADC_StreamStart(ConnectionID)).
+
+	The acquisition thread publishes blocks into one shared ring; each subscriber has its own sender thread and its
+	own cursors into the ring, so it sends at its own pace.  A block goes back to the card once every subscriber is
+	finished with it.  No subscriber can hold more than its MaxLag blocks: past that, its TAdcLagPolicy applies, so
+	a slow subscriber never stalls the acquisition or the other subscribers.
+
+	The acquisition starts with the first subscriber and stops with the last, or on Stop().  Each board has its own
+	session (TApciBoard::AdcStream), driving only that board's DMA ring.
+*/
+class TAdcStreamSession
+{
+public:
+	TAdcStreamSession(TApciBoard *Board) : Board(Board) {}
+	// stops the acquisition and waits for it to end
+	~TAdcStreamSession();
+
+	// streams to conn, starting the acquisition if nobody else is; 0, or -EEXIST, -EBUSY (no room), -errno
+	int Subscribe(int conn, TAdcLagPolicy policy = lagDropOldest, int maxLag = ADC_DEFAULT_MAX_LAG);
+	// stops streaming to conn; 0 or -ENOENT
+	int Unsubscribe(int conn);
+	// stops the acquisition and every subscriber
+	void Stop();
+	int ActiveSubscribers();
+
+	TAdcStreamStats Stats;
+
+protected:
+	static void *AcquisitionThread(void *arg);
+	void acquire();
+	static void *SenderThread(void *arg);
+	void sendTo(TAdcSubscriber &s);
+	// returns once every sender has left(), cutting off any that take too long; without SubscriberLock
+	void waitForSenders();
+
+	// SubscriberLock held
+	int find(int conn);
+	void enforceLag();
+	void retire();
+	void leave(TAdcSubscriber &s);
+
+	// sender-thread helpers
+	ssize_t sendBlocks(TAdcSubscriber &s, size_t first, int count);
+	ssize_t sendDatagrams(TAdcSubscriber &s, size_t first, int count);
+	void reapZeroCopy(TAdcSubscriber &s);
+	void retireInFlight(TAdcSubscriber &s);
+	bool waitZeroCopy(TAdcSubscriber &s, int timeoutMs);
+
+	// marks DMA slots finished with -- leased ones, or one just copied out -- and returns every finished slot at the
+	// front of the ring to the card, in one call
+	void releaseDmaSlots(const int *slots, int count, bool bLeased = true);
+	void releaseCopiedDmaSlot(int slot) { releaseDmaSlots(&slot, 1, false); }
+
+	TApciBoard *Board;
+
+	SpscRing<TAdcBlock> Blocks{RING_BUFFER_SLOTS};
+
+	std::mutex ControlLock; // starting and stopping the acquisition
+	pthread_t Worker;
+	bool bWorker = false;				// Worker is running or still to be joined; ControlLock
+	std::atomic<bool> bStopping{false}; // the acquisition is ending; set under SubscriberLock
+	void *DmaBuffer = nullptr;
+
+	std::mutex SubscriberLock; // Subscribers[], and handing blocks back (the ring's tail)
+	TAdcSubscriber *Subscribers[ADC_MAX_SUBSCRIBERS] = {};
+	int SubscriberCount = 0;
+	std::condition_variable SubscribersLeft; // SubscriberCount reached 0
+	size_t Retired = 0; // ring position every subscriber is finished up to
+
+	// DMA slot ownership; guarded by LeaseLock, which also serializes the board's DmaDataReady()/DmaDataDone()
+	std::mutex LeaseLock;
+	bool DmaReleased[RING_BUFFER_SLOTS] = {};
+	int DmaOldest = 0; // oldest slot not yet returned to the card
+	int DmaHeld = 0;   // slots taken from the card and not yet returned
+	int DmaLeased = 0; // of those, the ones published as leases and not yet released; ADC_LEASE_HIGH_WATER caps it
+	// copy-path storage, allocated by the first acquisition; a block only lands here when it can't be sent straight
+	// from its DMA slot
+	__u32 (*CopyBuffer)[SAMPLES_PER_TRANSFER] = nullptr;
+};
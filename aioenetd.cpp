@@ -8,7 +8,12 @@
 		DId 0x7001 "TCP_ConnectionID", 4 byte ConnectionID is the data
 	When a connection to ~8080+1 (the ADC Streaming port) occurs, send (__u32)(0x80000000|ConnectionID) ("Invalid ADC data value bit set + ConnectionID")
 
-	ADC_StreamStart(ConnectionID) uses ConnectionID as the connection to stream ADC data on.
+	A UDP datagram to ~8080+1 gets the same hello back, from a socket whose ConnectionID streams ADC data as datagrams.
+
+	ADC_StreamStart(ConnectionID) uses ConnectionID as a connection to stream ADC data on; up to ADC_MAX_SUBSCRIBERS
+	connections can watch the same acquisition.  Optional trailing bytes pick what happens when that connection falls
+	behind: (u8)TAdcLagPolicy, then (u16)MaxLag in 16 KiB blocks.
+	ADC_StreamStop(ConnectionID) stops streaming to one connection; ADC_StreamStop() stops the acquisition.
 */
 
 /*[aioenetd Protocol 2 TCP-Listener/Server Daemon/Service implementation and concept notes]
@@ -121,12 +126,14 @@ from discord code-review conversation with Daria; these do not belong in this so
 	]
 
 [program overview]
-	Main spawns one action-thread for handling Protocol 2.
+	Main spawns one action-thread (an action pipeline: see TActionPipeline) per board for handling Protocol 2.
 	NOTE: Main might also spawn a singleton receive/action/send thread, or one set per "Streaming" type (ADC in the eNET-AIO case), to handle the streaming Protocol(s).
-	Each Client that connects spawns a receive-thread.
+	Each Client that connects is handed to the ControlReactor (reactor.h); a fixed pool of I/O threads services every Control
+	socket through one edge-triggered epoll instance, so no thread is spawned per Client.
 
 	EITHER
 	1	the action-thread is responsible for sending data to the correct client
+		(implemented: it queues serialized Replies on the Client's TControlConnection, drained by the reactor's I/O threads)
 	OR
 	2	each per-client receive-thread spawns a send-thread and queue which is stuffed from the action-thread
 	OR
@@ -135,11 +142,12 @@ from discord code-review conversation with Daria; these do not belong in this so
 	Root listen in Main run-loop receives on primary connect listen_port#; valid connections spawn receive-threads that listen on the Socket
 	Multiple Clients can connect; each gets one listen-thread (and perhaps one send-queue & thread).
 
-	[receive-threads]
+	[receive-threads] (now the ControlReactor I/O threads, calling ControlReceived() once per complete Message framed out of the byte stream)
+		(The parsing below now happens on a ParseWorker, handed the framed Message by the I/O thread; see ControlReceived().)
 		Each receive-thread passes received bytes in >= Message-sized chunks to TMessage::fromBytes to construct a TMessage instance; .fromBytes is a
 		class factory method that will construct the appropriate TDataItem descendants based on the TMessage.Payload bytes' DIds.
-			errors throw exceptions; the exception handler will programmatically construct a TMessage to report the detected Errors
-		Regardless, the receive-thread Queues the TMessage (either the one constructed via .fromBytes() or via the caught exception handler)
+			errors are result codes, not exceptions; GotMessage() answers a Message that doesn't parse with an X Response reporting the first one
+		Otherwise the receive-thread Queues the TMessage constructed via .fromBytes()
 			into the action-thread's Queue to be handled, and resumes waiting for additional messages.
 			The TMessage that was Queued is now owned by the Action Queue;
 			In the case of an error the TMessage that was received goes out of scope and is destroyed when the receive-thread run-loop loops.
@@ -175,7 +183,7 @@ from discord code-review conversation with Daria; these do not belong in this so
 	[3. singleton send-thread]
 		Main constructs both the action-thread and send-thread; only one of each exist, each with one input Queue
 
-	The single Action Thread serves to serialize device operations, ensuring the Actions dictated in each received Message's payload get executed "atomically",
+	Each board's Action Thread serves to serialize that board's device operations, ensuring the Actions dictated in each received Message's payload get executed "atomically",
 	BUT the execution order is determined by the "parsing-finished" time, not by the "Message-received" time; i.e., each Client gets its turn in the order the
 	receive-threads' constructed TMessage gets added to the Action Queue.
 
@@ -188,19 +196,30 @@ from discord code-review conversation with Daria; these do not belong in this so
 
 #include <arpa/inet.h>
 #include <chrono>
+#include <cstring>
 #include <fcntl.h>
 #include <filesystem>
 #include <netinet/in.h>
 #include <signal.h>
 #include <unistd.h>
 #include <algorithm>
+#include <sstream>
+#include <unordered_map>
 
 #define LOGGING_DISABLE
 
 #include "logging.h"
 #include "TMessage.h"
 #include "adc.h"
+#include "apci.h"
+#include "apci_sim.h"
 #include "config.h"
+#include "reactor.h"
+#include "mpsc_queue.h"
+#include "safe_queue.h"
+#include "drr_scheduler.h"
+#include "message_arena.h"
+#include "work_stealing_pool.h"
 #include "DataItems/ADC_.h"
 #include "DataItems/BRD_.h"
 #include "DataItems/CFG_.h"
@@ -211,53 +230,134 @@ from discord code-review conversation with Daria; these do not belong in this so
 
 TConfig Config;
 
-int apci = -1;
 bool done = false;
 bool bTERMINATE = false;
 
 int ControlListenPort = 18767; // 0x494f, ASCII for "IO"
 int AdcListenPort = ControlListenPort + 1;
 
+// ActionThread scheduling classes; every queued Message of a lower-numbered class runs before any of a higher one
+typedef enum
+{
+	priorityUrgent = 0, // stop and interlock commands: see MessagePriority()
+	priorityNormal = 1,
+	priorityClasses
+} TActionPriority;
+
 typedef struct TActionQueueItemClass
 {
 	// pthread_t &sender; // which thread is responsible for sending results of the action to the client
 	// TActinQueue &SendQueue; // which queue to stuff Responses into for sending to Clients
-	int Socket; // which client is all this from/for
+	PTControlConnection Connection; // which client is all this from/for; replies are queued on its TxQueue
 	TMessage &theMessage;
+	TMessageArena *Arena; // holds theMessage, its DataItems, and this; see ReleaseAction()
+	TActionPriority Priority;
+	__u64 QueuedNs; // CLOCK_MONOTONIC when the Message was queued
+	TResourceMask Resources; // hardware its DataItems touch; set by ActionThread
+	bool bDone; // back from an ActionWorker, executed and answered
 } TActionQueueItem;
 
-typedef SafeQueue<TActionQueueItem*> TActionQueue;
+#define ACTION_QUEUE_DEPTH 4096
+#define ACTION_BATCH_SIZE 64
+#define CONTROL_MAX_IN_FLIGHT 256 // per Control connection, so 16 can fill a board's ActionQueue; AIOENETD_MAX_IN_FLIGHT overrides
+#define REJECT_LOG_INTERVAL 1000 // log a connection's first rejected Message, then every this many
+#define ACTION_QUANTUM 16 // DRR credit per turn per unit of Client weight; a single REG_Read1 Message costs 2
+#define CLIENT_MAX_WEIGHT 100
+#define CONTROL_URGENT_RESERVE 16 // in-flight Messages past MaxInFlight a connection may still have, if urgent
+#define ACTION_STATS_INTERVAL_NS 10000000000ull // how often ActionThread logs queue-wait latency per class
+#define ACTION_MAX_WORKERS 8 // per board; default is one per CPU, up to this; AIOENETD_ACTION_WORKERS overrides
+#define PARSE_POOL_DEPTH 1024 // raw Messages waiting for a ParseWorker, across all connections
+#define PARSE_MAX_WORKERS 8 // default is one per CPU, up to this; AIOENETD_PARSE_WORKERS overrides
+#define PARSE_POOL_MIN_BYTES 64 // smaller Messages are parsed on the I/O thread; about twice bench/parse_pool's break-even
+
+int MaxInFlight = CONTROL_MAX_IN_FLIGHT;
+int ActionWorkers = 0; // per board; 0: its ActionThread runs every Message itself
+int ParseWorkers = 0; // 0: the I/O thread that framed a Message parses it
+
+typedef MpscQueue<TActionQueueItem*> TActionQueue;
 //SafeQueue<pthread_t> ReceiverThreadQueue;
-TActionQueue ActionQueue;
 //TActionQueue ReplyQueue; // J2H: consider one per ReceiveThread...(i.e., make one ReplyThread per ReceiveThread, each with an associated queue)
 
+/*
+	Every board gets an action pipeline of its own -- ActionQueue, ActionThread and ActionWorkers -- whose threads make
+	it their current board (apciSetCurrentBoard()), so the DataItems they run reach that board and no other.  Boards
+	run in parallel; each ActionThread schedules, fairly and by resource, only its own board's Messages.  A Control
+	connection's Messages go to the board its last admitted BRD_Select picked, board 0 until it sends one: see
+	SelectBoard() and AdmitAction().  Replies keep their order per board; a Client that switches boards with Messages
+	still in flight on the old one can get the new board's Replies first.
+*/
+typedef struct TActionPipelineClass
+{
+	int Index; // in Pipelines[]
+	TApciBoard *Board;
+	TActionQueue ActionQueue{ACTION_QUEUE_DEPTH};
+	SafeQueue<TActionQueueItem *> WorkQueue; // ActionThread → ActionWorkers; nullptr tells one to exit
+	pthread_t Thread;
+} TActionPipeline;
+std::vector<std::unique_ptr<TActionPipeline>> Pipelines; // one per board, in apciBoard() order
+
+// a framed Message on its way from an I/O thread to a ParseWorker; lives in the Message's own arena
+typedef struct
+{
+	PTControlConnection Connection;
+	TMessageArena *Arena;
+	char *Bytes; // the Message; a copy in Arena if a ParseWorker parses it, as the I/O thread reuses its buffer
+	ssize_t Length;
+	__u64 Sequence; // from Connection->RxSequence
+} TParseJob;
+
 static void sig_handler(int sig);
-void OpenDevFile();
+void OpenDevices();
+void SelectRegisterBackend();
+void StartActionPipelines();
+void SelectAdmissionLimit();
+void SelectActionWorkers();
+void SelectParseWorkers();
+void LoadClientWeights();
+int ClientWeight(int Socket);
 void Intro(int argc, char **argv);
 void HandleNewAdcClients(int Socket, int addrSize, std::vector<int> &ClientList, struct sockaddr_in &addr, fd_set &ReadFDs);
 void HandleNewControlClients(int Socket, int addrSize, std::vector<int> &ClientList, struct sockaddr_in &addr, fd_set &ReadFDs);
-void *ActionThread(TActionQueue * Q);
+void *ActionThread(TActionPipeline *Pipeline);
+void ControlReceived(PTControlConnection conn, char buffer[], ssize_t bytesRead);
+void ParseReceived(TParseJob *job);
+void SendResponse(PTControlConnection Client, TMessage &aMessage);
 void *ControlListenerThread(void* arg);
 void *AdcListenerThread(void *arg);
-pthread_t action_thread;
+void *AdcDatagramListenerThread(void *arg);
 pthread_t controlListener_thread;
 pthread_t adcListener_thread;
 pthread_t controlListener6_thread;
 pthread_t adcListener6_thread;
+pthread_t adcDatagramListener_thread;
+TReactor ControlReactor(&ControlReceived); // owns every Control connection socket
+WorkStealingPool<TParseJob *> ParsePool(&ParseReceived, PARSE_POOL_DEPTH); // I/O threads → ParseWorkers
 
 int main(int argc, char *argv[])
 {
 	Intro(argc, argv);
 	LoadConfig();
-	OpenDevFile(); // sets apci
-
-	pthread_create(&action_thread, NULL, (void*(*)(void *))&ActionThread, &ActionQueue);
+	OpenDevices();
+	SelectRegisterBackend();
+	SelectAdmissionLimit();
+	SelectActionWorkers();
+	SelectParseWorkers();
+	LoadClientWeights();
+
+	StartActionPipelines();
+	ParsePool.Start(ParseWorkers);
+	if (ControlReactor.Start() < 0)
+	{
+		Error("Control reactor failed to start");
+		exit(EXIT_FAILURE);
+	}
 
 	// pthread_create(&controlListener_thread, NULL, ControlListenerThread, (void*)AF_INET);
 	// pthread_create(&adcListener_thread, NULL, AdcListenerThread, (void*)AF_INET);
 
 	pthread_create(&controlListener6_thread, NULL, ControlListenerThread, (void*)AF_INET6);
 	pthread_create(&adcListener6_thread, NULL, AdcListenerThread, (void*)AF_INET6);
+	pthread_create(&adcDatagramListener_thread, NULL, AdcDatagramListenerThread, NULL);
 
 	sleep(2);
 	do
@@ -268,8 +368,14 @@ int main(int argc, char *argv[])
 	std::time_t end_time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
 	pthread_cancel(controlListener_thread);
 	pthread_cancel(adcListener_thread);
-	pthread_cancel(action_thread);
-	close(apci);
+	pthread_cancel(adcDatagramListener_thread);
+	ParsePool.Stop();
+	for (auto &pipeline : Pipelines)
+		pipeline->ActionQueue.Stop();
+	for (auto &pipeline : Pipelines)
+		pthread_join(pipeline->Thread, NULL);
+	ControlReactor.Stop();
+	apciCloseBoards(); // closes their device files
 	Log("AIOeNET Daemon " VersionString " CLOSING, it is now: " + std::string(std::ctime(&end_time)));
 	// TODO:  if (bReboot) syscall("reboot"); // for isp-fpga
 	return 0;
@@ -292,29 +398,120 @@ void Intro(int argc, char **argv)
 	Trace(std::string("Control port: ") + std::to_string(ControlListenPort));
 }
 
-void OpenDevFile()
+// every /dev/apci entry that opens is a board, numbered in name order.
+// AIOENETD_DEVICE=sim runs against AIOENETD_SIM_BOARDS (default 1) simulated eNET-AIO16-16Fs instead, each streaming ADC
+// data at AIOENETD_SIM_RATE samples/second; for load-testing on machines without the hardware.
+void OpenDevices()
 {
-	std::string devicefile = "";
-	std::string devicepath = "/dev/apci";
-	for (const auto &devfile : std::filesystem::directory_iterator(devicepath))
+	const char *device = getenv("AIOENETD_DEVICE");
+	if ((device != nullptr) && !strcmp(device, "sim"))
 	{
-		apci = open(devfile.path().c_str(), O_RDONLY);
-		if (apci >= 0)
-		{
-			devicefile = devfile.path().c_str();
-			break;
-		}
+		const char *rate = getenv("AIOENETD_SIM_RATE");
+		const char *boards = getenv("AIOENETD_SIM_BOARDS");
+		for (int i = 0; i < std::max(boards ? atoi(boards) : 1, 1); i++)
+			apciAddBoard(new TApciSimDevice(rate ? atof(rate) : SIM_DEFAULT_SAMPLE_RATE));
+		return;
 	}
-	Log("Opening device @ " + devicefile);
+
+	std::vector<std::string> devicefiles;
+	std::error_code ec;
+	for (const auto &devfile : std::filesystem::directory_iterator("/dev/apci", ec))
+		devicefiles.push_back(devfile.path().string());
+	std::sort(devicefiles.begin(), devicefiles.end()); // so a board keeps its number from one start to the next
+	for (auto &devicefile : devicefiles)
+	{
+		int fd = open(devicefile.c_str(), O_RDONLY);
+		if (fd < 0)
+			continue;
+		Log("Opening device @ " + devicefile + " as board " + std::to_string(apciBoardCount()));
+		apciAddBoard(new TApciFileDevice(fd));
+	}
+	if (apciBoardCount() == 0)
+		Error("no device under /dev/apci could be opened");
 }
 
-void Bind(int &Socket, int &Port, void * structaddr, int iNET)
+// AIOENETD_REGISTERS=ioctl|mmap|fake picks how register reads/writes reach the card; default is mmap, which falls
+// back to ioctl if the BAR can't be mapped.  "fake" runs against an in-process BAR, for testing without hardware.
+// The simulated device has no BAR to map, so it defaults to ioctl (i.e. calls into the simulator).  Applies to every
+// board; each one maps its own BAR.
+void SelectRegisterBackend()
+{
+	const char *choice = getenv("AIOENETD_REGISTERS");
+	bool bChosen = (choice != nullptr) && (*choice != 0);
+	TRegisterBackend chosen = rbMmap;
+	if (bChosen)
+	{
+		if (!strcmp(choice, "ioctl"))
+			chosen = rbIoctl;
+		else if (!strcmp(choice, "fake"))
+			chosen = rbFake;
+		else if (strcmp(choice, "mmap"))
+			Error(std::string("unknown AIOENETD_REGISTERS=") + choice + "; using mmap");
+	}
+	for (int i = 0; i < apciBoardCount(); i++)
+	{
+		TApciBoard *board = apciBoard(i);
+		if (bChosen)
+			board->SelectRegisterBackend(chosen);
+		else
+			board->SelectRegisterBackend(dynamic_cast<TApciSimDevice *>(board->Device) ? rbIoctl : rbMmap);
+	}
+}
+
+void SelectAdmissionLimit()
+{
+	const char *limit = getenv("AIOENETD_MAX_IN_FLIGHT");
+	if ((limit != nullptr) && (atoi(limit) > 0))
+		MaxInFlight = atoi(limit);
+	Log("Control connections may have " + std::to_string(MaxInFlight) + " Messages in flight");
+}
+
+// one ActionWorker per CPU; a single worker would only add hand-offs, so that is none
+void SelectActionWorkers()
+{
+	const char *workers = getenv("AIOENETD_ACTION_WORKERS");
+	ActionWorkers = (workers != nullptr) ? atoi(workers) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	ActionWorkers = std::min(std::max(ActionWorkers, 0), ACTION_MAX_WORKERS);
+	if (ActionWorkers == 1)
+		ActionWorkers = 0;
+	Log("Messages execute on " + (ActionWorkers ? std::to_string(ActionWorkers) + " ActionWorker threads"
+											   : std::string("the ActionThread")) + " of their board");
+}
+
+// one action pipeline per board; with no board open, one for the stand-in apciCurrentBoard() gives, so Messages are
+// still answered
+void StartActionPipelines()
+{
+	for (int i = 0; i < std::max(apciBoardCount(), 1); i++)
+	{
+		TActionPipeline *pipeline = new TActionPipeline;
+		pipeline->Index = i;
+		pipeline->Board = apciBoard(i) ? apciBoard(i) : apciCurrentBoard();
+		Pipelines.emplace_back(pipeline);
+		pthread_create(&pipeline->Thread, NULL, (void*(*)(void *))&ActionThread, pipeline);
+	}
+	Log(std::to_string(Pipelines.size()) + " action pipelines, one per board");
+}
+
+// one ParseWorker per CPU, as for ActionWorkers; with one CPU the I/O thread might as well parse
+void SelectParseWorkers()
+{
+	const char *workers = getenv("AIOENETD_PARSE_WORKERS");
+	ParseWorkers = (workers != nullptr) ? atoi(workers) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	ParseWorkers = std::min(std::max(ParseWorkers, 0), PARSE_MAX_WORKERS);
+	if ((workers == nullptr) && (ParseWorkers == 1))
+		ParseWorkers = 0;
+	Log("Messages are parsed on " + (ParseWorkers ? std::to_string(ParseWorkers) + " ParseWorker threads"
+											   : std::string("the Control I/O threads")));
+}
+
+void Bind(int &Socket, int &Port, void * structaddr, int iNET, int type = SOCK_STREAM)
 {
 	struct sockaddr_in * addr4 = (sockaddr_in *)structaddr;
 	struct sockaddr_in6 * addr6 = (sockaddr_in6 *)structaddr;
 	int result = -1;
 
-	if ((Socket = socket(iNET, SOCK_STREAM, 0)) == 0)
+	if ((Socket = socket(iNET, type, 0)) == 0)
 	{
 		perror("socket failed");
 		exit(EXIT_FAILURE);
@@ -449,6 +646,39 @@ void *AdcListenerThread(void* arg)
 	return nullptr;
 }
 
+// UDP on AdcListenPort: any datagram is a "hello", answered -- like a TCP ADC connection -- with the ConnectionID, from
+// the peer's UDP socket connected back to it (see TAdcDatagramPeers).  ADC_StreamStart(ConnectionID) then streams ADC
+// data to it as datagrams (see TAdcDatagramHeader).
+void *AdcDatagramListenerThread(void *arg)
+{
+	struct sockaddr_in6 AdcAddr6;
+	int AdcSocket;
+
+	Log("Binding ADC datagrams for IPv6");
+	Bind(AdcSocket, AdcListenPort, &AdcAddr6, AF_INET6, SOCK_DGRAM);
+	for (;;)
+	{
+		AdcDatagramPeers.Sweep();
+		struct pollfd fds[1 + ADC_MAX_DATAGRAM_PEERS];
+		fds[0] = {AdcSocket, POLLIN, 0};
+		int count = 1 + AdcDatagramPeers.Sockets(&fds[1]);
+		if (poll(fds, count, 1000) <= 0) // wakes up to close idle peers' sockets even with no datagrams arriving
+			continue;
+		for (int i = 1; i < count; i++)
+			if (fds[i].revents)
+				AdcDatagramPeers.Rehello(fds[i].fd, &SendAdcHello);
+		if (!(fds[0].revents & POLLIN))
+			continue;
+		struct sockaddr_in6 peer;
+		socklen_t peerSize = sizeof(peer);
+		__u8 buffer[64];
+		if ((recvfrom(AdcSocket, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&peer, &peerSize) >= 0) &&
+			(peerSize == sizeof(peer)))
+			AdcDatagramPeers.Hello(peer, AdcAddr6, &SendAdcHello);
+	}
+	return nullptr;
+}
+
 void SendControlHello(int Socket)
 {
 	TMessageId MId_Hello = 'H';
@@ -474,11 +704,13 @@ void SendControlHello(int Socket)
 	PTDataItem features = std::unique_ptr<TBRD_Features>(new TBRD_Features());
 	PTDataItem deviceID = std::unique_ptr<TBRD_DeviceID>(new TBRD_DeviceID());
 	PTDataItem adcBaseClock = std::unique_ptr<TADC_BaseClock>(new TADC_BaseClock());
+	PTDataItem boards = std::unique_ptr<TBRD_Select>(new TBRD_Select()); // board 0, which a new connection starts on
 	try{
 		fpgaId->Go(); Payload.push_back(fpgaId);
 		features->Go(); Payload.push_back(features);
 		deviceID->Go(); Payload.push_back(deviceID);
 		adcBaseClock->Go(); Payload.push_back(adcBaseClock);
+		boards->Go(); Payload.push_back(boards);
 	}
 	catch(std::logic_error e)
 	{
@@ -518,73 +750,234 @@ void Disconnect(int aClient, std::vector<int> &ClientList)
 	}
 }
 
-bool GotMessage(char theBuffer[], int bytesRead, TMessage &parsedMessage)
+// parses a Message into arena; nullptr if it doesn't parse, in which case conn has already been sent the X Response:
+// one INVALID (FFFF) DataItem whose Data is the TError (u32) and the index (u16) of the DataItem it was found in
+TMessage *GotMessage(PTControlConnection conn, char theBuffer[], int bytesRead, TMessageArena &arena)
 {
 	TError result;
-	TBytes buf(theBuffer, theBuffer + bytesRead);
-	// Log("buf has ", buf);
-	// buf.clear();
-	// // TODO: DOES NOT WORK? // buf.assign(buffer, buffer + bytesRead); // turn buffer into TBytes
-	// for (int i = 0; i < bytesRead; i++) buf.push_back(theBuffer[i]);
+	TBytesView buf((const __u8 *)theBuffer, bytesRead); // parsed in place; no copy of the receive buffer
 	Debug("Received " + std::to_string(buf.size()) + " bytes, from Control Client: ", buf);
 
-	parsedMessage = TMessage::FromBytes(buf, result);
+	TMessage *parsedMessage = arena.make<TMessage>(TMessage::FromBytes(buf, result, &arena));
 
 	if (result != ERR_SUCCESS)
 	{
-		Error("TMessage::fromBytes(buf) returned " + std::to_string(result) + err_msg[-result]);
+		Error("TMessage::fromBytes(buf) returned " + std::to_string(result) + ", " + err_msg[-result]);
+		__u8 detail[sizeof(TError) + sizeof(__u16)];
+		TPayloadWriter out(detail);
+		out.put<TError>(result);
+		out.put<__u16>(parsedMessage->DataItems.size()); // parsePayload() stopped at the bad one
+		TMessage syntaxError('X', &arena);
+		syntaxError.DataItems.push_back(construct<TDataItem>(INVALID, TBytesView(detail, out.length), &arena));
+		SendResponse(conn, syntaxError);
+		TMessageArena::destroy(parsedMessage);
+		return nullptr;
+	}
+	Log("Received on Control connection:\n          " + parsedMessage->AsString());
+	return parsedMessage;
+}
+
+__u64 NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+	A Message is urgent -- run before every queued normal Message, from any Client -- if its sender set
+	bmMessageUrgent in payload_size, or if every DataItem in it stops or drives something: ADC_StreamStop, BRD_Reset,
+	and the DAC and DIO output DIds.  A normal Message that merely includes one of those stays normal, so a bundle
+	can't jump the queue on the strength of one DataItem.  An urgent Message can overtake its own connection's
+	earlier normal Messages; that is the point.
+*/
+bool isUrgentDId(DataItemIds DId)
+{
+	switch (DId)
+	{
+	case ADC_StreamStop:
+	case BRD_Reset:
+	case DAC_Output1:
+	case DAC_OutputAll:
+	case DAC_OutputSome:
+	case DIO_Output1:
+	case DIO_OutputAll:
+	case DIO_OutputSome:
+	case DIO_Clear1:
+	case DIO_ClearAll:
+	case DIO_ClearSome:
+	case DIO_Set1:
+	case DIO_SetAll:
+	case DIO_SetSome:
+		return true;
+	default:
 		return false;
 	}
-	Log("Received on Control connection:\n          " + parsedMessage.AsString());
-	return true;
 }
 
-void *threadReceiver(void *arg) // J2H: In progress
+TActionPriority MessagePriority(TMessage &aMessage)
 {
-	int controlSocket = (long long )arg;
+	if (aMessage.isUrgent())
+		return priorityUrgent;
+	if (aMessage.DataItems.empty())
+		return priorityNormal;
+	for (auto &anItem : aMessage.DataItems)
+		if (!isUrgentDId(anItem.getDId()))
+			return priorityNormal;
+	return priorityUrgent;
+}
 
-	Log("New Control connection thread, socket fd is: " + std::to_string(controlSocket));
-	SendControlHello(controlSocket);
+// frees a queued Message and its DataItems, all in one go
+void ReleaseAction(TActionQueueItem *anAction)
+{
+	TMessageArena *arena = anAction->Arena;
+	TMessageArena::destroy(&anAction->theMessage);
+	TMessageArena::destroy(anAction);
+	delete arena;
+}
 
-	ssize_t bytesRead = 0;
-	int bufLen = maxPayloadLength + minimumMessageLength + 1;
-	char buffer[bufLen];
-	do
+/*
+	Admission control: a Control connection may have MaxInFlight Messages queued or executing; each board's
+	ActionQueue holds ACTION_QUEUE_DEPTH across all of them.  A Message past either limit is not run: it is answered
+	at once with an "E" Response echoing its DataItems, so one flooding Client can't grow the queue, or everyone's
+	latency, without bound.  That E can overtake the Responses to the connection's earlier, admitted, Messages.
+*/
+void Reject(PTControlConnection conn, TMessage &aMessage, const char *why)
+{
+	__u64 rejected = ++conn->Rejected;
+	if ((rejected % REJECT_LOG_INTERVAL) == 1)
+		Error(std::string(err_msg[-ERR_BUSY]) + ": " + why + "; Control connection " + std::to_string(conn->Socket) +
+			  " has had " + std::to_string(rejected) + " Messages rejected");
+	aMessage.setMId('E');
+	SendResponse(conn, aMessage);
+}
+
+/*
+	Parsing is off the I/O threads: ControlReceived() copies each framed Message into a fresh arena and hands it to
+	the ParsePool, whose workers validate and build TMessages in parallel, on as many cores as there are.  They
+	finish out of order, so each connection numbers its Messages as they are framed and QueueParsed() releases them
+	to admission control and the ActionQueue strictly in that order; the ActionThread sees each Client's Messages in
+	the order it sent them, as when the I/O thread parsed them itself.  X Responses to Messages that don't parse
+	are sent by the ParseWorker right away, so they can overtake Responses to the same Client's earlier Messages,
+	as E and R Responses already could.
+
+	When the pool is full, or has no workers, the I/O thread parses the Message itself, through the same ordering:
+	a Client sending faster than the pool can parse is slowed to the pace of its own I/O thread.  So does it with a
+	Message under PARSE_POOL_MIN_BYTES, which it parses in less time than the copy and hand-off would take it.
+*/
+
+// called by a ControlReactor I/O thread for every complete Message framed on a Control connection
+void ControlReceived(PTControlConnection conn, char buffer[], ssize_t bytesRead)
+{
+	TMessageArena *arena = new TMessageArena; // ParseReceived() deletes it, or gives it to the ActionQueueItem
+	TParseJob *job = arena->make<TParseJob>(TParseJob{conn, arena, buffer, bytesRead, conn->RxSequence++});
+	if (ParsePool.threadCount() && (bytesRead >= PARSE_POOL_MIN_BYTES))
 	{
-		if ((bytesRead = recv(controlSocket, buffer, bufLen, MSG_NOSIGNAL)) < 0)
-		{
-			Error("error on Control recv(): " + std::to_string(errno));
-			// error handling? frex "connection closed" or EAGAIN or EINTR?
-			continue;
-		}
+		job->Bytes = (char *)arena->allocate(bytesRead, 1);
+		memcpy(job->Bytes, buffer, bytesRead);
+		if (ParsePool.trySubmit(job, conn->Socket))
+			return;
+		job->Bytes = buffer;
+	}
+	ParseReceived(job);
+}
 
-		if (bytesRead == 0)
+// the board a Message runs on: the one its last BRD_Select(board) picks, or else the connection's board.  Changes
+// nothing; AdmitAction() makes it the connection's board only once the Message is queued.  Called with ParsedLock held
+int SelectBoard(PTControlConnection conn, TMessage &aMessage)
+{
+	int board = conn->Board;
+	for (auto &anItem : aMessage.DataItems)
+		if (anItem.getDId() == BRD_Select)
 		{
-			struct sockaddr_in addr;
-			socklen_t addrSize = sizeof(addr);
-			getpeername(controlSocket, (struct sockaddr *)&addr, (socklen_t *)&addrSize);
-			Log(std::string("Host disconnected Control connection " + std::to_string(controlSocket) + ", ip: ") + inet_ntoa(addr.sin_addr) + ", listen_port " + std::to_string(ntohs(addr.sin_port)));
-			close(controlSocket);
-			break; // end listener thread
+			int selected = anItem.visit([](TDataItem &x) { return static_cast<TBRD_Select &>(x).getBoard(); });
+			if (selected >= 0)
+				board = selected;
 		}
-		else
-		{
-			try
-			{
-				TMessage *aMessage = new TMessage;
-				if (!GotMessage(buffer, bytesRead, *aMessage))
-					continue;
-				TActionQueueItem *Action = new TActionQueueItem{controlSocket, *aMessage };
-				ActionQueue.enqueue(Action);
-			}
-			catch (std::logic_error e)
-			{
-				Error(e.what());
-			}
-		}
-	} while (1);
-	Log("Closing threadReceiver for connection " + std::to_string(controlSocket));
-	return nullptr;
+	return board;
+}
+
+// runs a Message through admission control into its board's ActionQueue, or answers it with E at once.  A Message
+// that gets in makes its board the connection's board for the Messages after it; a rejected one changes nothing
+void AdmitAction(TActionQueueItem *Action)
+{
+	PTControlConnection conn = Action->Connection;
+	int board = SelectBoard(conn, Action->theMessage);
+	if (board >= (int)Pipelines.size())
+	{
+		Error("Control connection " + std::to_string(conn->Socket) + " selected a board past the " +
+			  std::to_string(Pipelines.size()) + " there are");
+		Action->theMessage.setMId('E');
+		SendResponse(conn, Action->theMessage);
+		ReleaseAction(Action);
+		return;
+	}
+	int depth = ++conn->InFlight;
+	if (depth > MaxInFlight + ((Action->Priority == priorityUrgent) ? CONTROL_URGENT_RESERVE : 0))
+	{
+		conn->InFlight--;
+		Reject(conn, Action->theMessage, "too many Messages in flight");
+		ReleaseAction(Action);
+		return;
+	}
+	for (int peak = conn->PeakInFlight; (depth > peak) && !conn->PeakInFlight.compare_exchange_weak(peak, depth);)
+		;
+	Action->QueuedNs = NowNs();
+	if (Pipelines[board]->ActionQueue.tryEnqueue(Action))
+	{
+		// ParsedLock is held, so the connection's board follows the order the Client sent its Messages
+		conn->Board = board;
+		return; // ReleaseAction() frees it
+	}
+	conn->InFlight--;
+	Reject(conn, Action->theMessage, "ActionQueue full");
+	ReleaseAction(Action);
+}
+
+// admits conn's Message number sequence once every earlier one has been; Action is nullptr if it was already answered
+void QueueParsed(PTControlConnection conn, __u64 sequence, TActionQueueItem *Action)
+{
+	std::lock_guard<std::mutex> lock(conn->ParsedLock);
+	if (sequence != conn->NextToQueue)
+	{
+		conn->Parsed[sequence] = Action; // an earlier Message is still being parsed; it will admit this one
+		return;
+	}
+	if (Action)
+		AdmitAction(Action);
+	conn->NextToQueue++;
+	for (auto next = conn->Parsed.begin(); (next != conn->Parsed.end()) && (next->first == conn->NextToQueue);
+		 next = conn->Parsed.erase(next))
+	{
+		if (next->second)
+			AdmitAction(next->second);
+		conn->NextToQueue++;
+	}
+}
+
+// a ParseWorker's job, or the I/O thread's if the pool couldn't take it
+void ParseReceived(TParseJob *job)
+{
+	PTControlConnection conn = job->Connection;
+	__u64 sequence = job->Sequence;
+	std::unique_ptr<TMessageArena> arena(job->Arena); // until the ActionQueueItem has it
+	TActionQueueItem *Action = nullptr;
+	try
+	{
+		TMessage *aMessage = GotMessage(conn, job->Bytes, job->Length, *arena);
+		if (aMessage)
+			Action = arena->make<TActionQueueItem>(TActionQueueItem{
+				.Connection = conn, .theMessage = *aMessage, .Arena = arena.get(),
+				.Priority = MessagePriority(*aMessage), .QueuedNs = 0, .Resources = 0, .bDone = false});
+	}
+	catch (const std::logic_error &e)
+	{
+		Error(e.what());
+	}
+	TMessageArena::destroy(job);
+	if (Action)
+		arena.release(); // ReleaseAction() frees it
+	QueueParsed(conn, sequence, Action); // even if it didn't parse, so the Messages after it aren't held up
 }
 
 void HandleNewControlClients(int ControlListenSocket, int addrSize, std::vector<int> &ClientList, struct sockaddr_in &addr, fd_set &ReadFDs)
@@ -597,13 +990,10 @@ void HandleNewControlClients(int ControlListenSocket, int addrSize, std::vector<
 		perror("accept failed");
 		exit(EXIT_FAILURE);
 	}
-	pthread_t receive_thread;
 	Log("New Control connection, socket fd is: " + std::to_string(new_socket));
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
-	pthread_create(&receive_thread, NULL, &threadReceiver, (void *) new_socket); // spawn Control Read thread here, pass in new_socket
-#pragma GCC diagnostic pop
-	// ReceiverThreadQueue.enqueue(receive_thread);
+	SendControlHello(new_socket);
+	if (ControlReactor.Add(new_socket, ClientWeight(new_socket)) < 0) // the reactor's I/O threads handle all receives from here on
+		close(new_socket);
 }
 
 
@@ -612,11 +1002,11 @@ bool RunMessage(TMessage &aMessage)
 	Trace("Executing Message DataItems[].Go(), " + std::to_string(aMessage.DataItems.size()) + " total DataItems");
 	try
 	{
-		for (auto anItem : aMessage.DataItems)
-			anItem->Go();
+		for (auto &anItem : aMessage.DataItems)
+			anItem.Go();
 		aMessage.setMId('R'); // FIX: should be performed based on anItem.getResultCode() indicating no errors
 	}
-	catch (std::logic_error e)
+	catch (const std::logic_error &e)
 	{
 		aMessage.setMId('X');
 		Error(e.what());
@@ -627,30 +1017,271 @@ bool RunMessage(TMessage &aMessage)
 	return true;
 }
 
-void SendResponse(int Client, TMessage &aMessage)
+// serializes the Reply and hands it to the Client's send queue; never blocks on the network
+void SendResponse(PTControlConnection Client, TMessage &aMessage)
 {
-	TBytes rbuf = aMessage.AsBytes(true);					   // valgrind
-	ssize_t bytesSent = send(Client, rbuf.data(), rbuf.size(), MSG_NOSIGNAL); // valgrind
-	if (bytesSent == -1)
+	// serialize straight into a recycled per-connection buffer; no allocation in steady state
+	TBytes rbuf = Client->AcquireBuffer(aMessage.encodedSize(true));
+	auto size = aMessage.writeTo(rbuf.data(), true);
+	if (Client->Send(std::move(rbuf)) < 0)
 	{
-		Error("! TCP Send of Reply to Control failed, bytesSent != Message Length (" + std::to_string(bytesSent) + " != " + std::to_string(rbuf.size()) + ")");
-		// handle xmit error
+		Error("! Reply to Control Client# " + std::to_string(Client->Socket) + " discarded; connection closed or stalled");
 	}
 	else
 	{
-		Trace("sent Reply to Control Client# " + std::to_string(Client) + " " + std::to_string(bytesSent) + " bytes: ", rbuf);
+		Trace("queued Reply to Control Client# " + std::to_string(Client->Socket) + " " + std::to_string(size) + " bytes");
 	}
 }
 
-void *ActionThread(TActionQueue * Q)
+/*
+	The ActionThread runs Messages fairly across Control connections rather than in arrival order: everything
+	queued is sorted into per-connection flows, and flows take turns by deficit round robin (drr_scheduler.h), each
+	getting ACTION_QUANTUM * its weight of credit per turn.  So a Client pipelining big bundles can't starve one
+	polling with single REG_Read1s, and a heavily weighted Client (a safety interlock, say) waits at most one turn
+	of each other busy Client.  Messages are still the unit: every DataItem of one Message runs before any other
+	Message's, and each Client's normal Messages run in the order it sent them.  Urgent Messages (see
+	MessagePriority()) have a lane of their own, fair in the same way, that is always drained first.
+
+	With ActionWorkers, the ActionThread only chooses: Messages run on a pool of worker threads, several at once when
+	they touch disjoint hardware.  Every DataItem says which resources its .Go() touches (TResourceMask: the ADC, the
+	DAC SPI bus, the DIO SPI bus, the rest of the board); a Message holds the union of its DataItems' for as long as
+	it runs, so no two running Messages share a resource, and each Message still runs as a unit.  A Client has at
+	most one Message running, so its Replies keep their order.  A Message that has to wait for a resource keeps its
+	place in line and the resource is held for it, so a BRD_Reset, which needs all of them, isn't starved by a
+	stream of Messages that each need one.
+
+	A Message's cost is a rough estimate of its execution time, in units of one register access: see
+	MessageCost().  Weights come from Config.clientWeights, "ip=weight,ip=weight,..."; unlisted Clients get 1.
+*/
+std::unordered_map<std::string, int> ClientWeights;
+
+void LoadClientWeights()
 {
-	for (;;) {
-		TActionQueueItem *anAction = ActionQueue.dequeue();
-		Log("---DEQUEUED---");
+	std::stringstream list(Config.clientWeights);
+	std::string entry;
+	while (std::getline(list, entry, ','))
+	{
+		size_t equals = entry.rfind('=');
+		int weight = (equals == std::string::npos) ? 0 : atoi(entry.c_str() + equals + 1);
+		if ((weight < 1) || (weight > CLIENT_MAX_WEIGHT))
+		{
+			Error("ignoring TCP_ClientWeights entry \"" + entry + "\"; expected ip=weight, weight 1.." +
+				  std::to_string(CLIENT_MAX_WEIGHT));
+			continue;
+		}
+		ClientWeights[entry.substr(0, equals)] = weight;
+		Log("Control Clients from " + entry.substr(0, equals) + " get scheduling weight " + std::to_string(weight));
+	}
+}
+
+// looked up once per connection, when it is accepted and Socket is still certainly the Client's
+int ClientWeight(int Socket)
+{
+	struct sockaddr_in6 addr;
+	socklen_t addrSize = sizeof(addr);
+	char ip[INET6_ADDRSTRLEN];
+	if (ClientWeights.empty() || getpeername(Socket, (struct sockaddr *)&addr, &addrSize) ||
+		(addr.sin6_family != AF_INET6) || !inet_ntop(AF_INET6, &addr.sin6_addr, ip, sizeof(ip)))
+		return 1;
+	std::string peer = ip;
+	if ((peer.rfind("::ffff:", 0) == 0) && (peer.find('.') != std::string::npos))
+		peer.erase(0, 7); // IPv4 Clients arrive IPv4-mapped
+	auto found = ClientWeights.find(peer);
+	return (found != ClientWeights.end()) ? found->second : 1;
+}
+
+// estimated execution cost of a Message, in register accesses
+size_t MessageCost(TMessage &aMessage)
+{
+	size_t cost = 1; // parse, reply, bookkeeping
+	for (auto &anItem : aMessage.DataItems)
+		switch (anItem.getDId() & 0xFF00)
+		{
+		case REG_:
+			cost += 1;
+			break;
+		case DAC_:
+		case DIO_:
+		case PWM_:
+			cost += 4; // SPI transfers, with a wait for not-busy
+			break;
+		case ADC_:
+		case ADC_Stream:
+			cost += (anItem.getDId() >= ADC_Stream) ? 16 : 2; // streaming starts and stops threads and DMA
+			break;
+		default:
+			cost += 8; // BRD_, CFG_ and the like: config files, system calls
+		}
+	return cost;
+}
+
+// queue-wait latency of one TActionPriority class: from ControlReceived() queuing a Message to ActionThread starting it
+typedef struct
+{
+	__u64 count = 0;
+	__u64 totalNs = 0;
+	__u64 maxNs = 0;
+	__u64 buckets[64] = {}; // count by log2(ns), for percentiles
+} TQueueWaitStats;
+
+void AddQueueWait(TQueueWaitStats &stats, __u64 ns)
+{
+	stats.count++;
+	stats.totalNs += ns;
+	stats.maxNs = std::max(stats.maxNs, ns);
+	stats.buckets[63 - __builtin_clzll(ns | 1)]++;
+}
+
+// upper bound of the bucket holding the given fraction of waits
+__u64 QueueWaitPercentile(TQueueWaitStats &stats, double fraction)
+{
+	__u64 seen = 0;
+	for (int i = 0; i < 64; i++)
+		if ((seen += stats.buckets[i]) >= fraction * stats.count)
+			return std::min(2ull << i, stats.maxNs);
+	return stats.maxNs;
+}
+
+void LogQueueWaits(int board, TQueueWaitStats stats[priorityClasses])
+{
+	static const char *names[priorityClasses] = {"urgent", "normal"};
+	for (int c = 0; c < priorityClasses; c++)
+	{
+		if (!stats[c].count)
+			continue;
+		Log("board " + std::to_string(board) + " ActionQueue wait, " + names[c] + ": " + std::to_string(stats[c].count) +
+			" Messages, mean " + std::to_string(stats[c].totalNs / stats[c].count / 1000) + " us, p99 < " +
+			std::to_string(QueueWaitPercentile(stats[c], 0.99) / 1000) + " us, max " +
+			std::to_string(stats[c].maxNs / 1000) + " us");
+		stats[c] = TQueueWaitStats();
+	}
+}
+
+typedef DrrScheduler<TActionQueueItem *, TControlConnection *> TActionScheduler;
+
+// the hardware a Message's DataItems touch, all of which it holds while it runs
+TResourceMask MessageResources(TMessage &aMessage)
+{
+	TResourceMask resources = 0;
+	for (auto &anItem : aMessage.DataItems)
+		resources |= anItem.getResources();
+	return resources;
+}
+
+// runs Messages its board's ActionThread hands it, and hands them back through the ActionQueue once answered
+void *ActionWorker(void *arg)
+{
+	TActionPipeline *pipeline = (TActionPipeline *)arg;
+	apciSetCurrentBoard(pipeline->Board);
+	while (TActionQueueItem *anAction = pipeline->WorkQueue.dequeue())
+	{
 		RunMessage(anAction->theMessage);
-		SendResponse(anAction->Socket, anAction->theMessage); // move to send threads?
-		free(anAction);
+		SendResponse(anAction->Connection, anAction->theMessage);
+		anAction->bDone = true;
+		pipeline->ActionQueue.enqueue(anAction);
+	}
+	return nullptr;
+}
+
+void *ActionThread(TActionPipeline *Pipeline)
+{
+	TActionQueue *Q = &Pipeline->ActionQueue;
+	int board = Pipeline->Index;
+	apciSetCurrentBoard(Pipeline->Board);
+	TActionQueueItem *Actions[ACTION_BATCH_SIZE];
+	// one lane per TActionPriority, each fair across connections; the urgent lane is always drained first
+	TActionScheduler Lanes[priorityClasses] = {TActionScheduler(ACTION_QUANTUM), TActionScheduler(ACTION_QUANTUM)};
+	TQueueWaitStats Waits[priorityClasses];
+	__u64 lastReport = NowNs();
+	pthread_t workers[ACTION_MAX_WORKERS];
+	for (int i = 0; i < ActionWorkers; i++)
+		pthread_create(&workers[i], NULL, ActionWorker, Pipeline);
+	int running = 0;			  // Messages out on ActionWorkers
+	TResourceMask busy = 0;		  // the resources they hold
+	auto idle = [&] { return Lanes[priorityUrgent].empty() && Lanes[priorityNormal].empty(); };
+	auto finish = [&](TActionQueueItem *anAction) {
+		anAction->Connection->InFlight--;
+		ReleaseAction(anAction);
+	};
+	bool bMore = false; // the last batch was full: more may be waiting
+	for (;;) {
+		// take everything queued; sleep when there is nothing to run, or (with ActionWorkers) nothing more that can
+		// start until a Message arrives or one finishes -- but never straight after a full batch, whose Messages
+		// haven't been dispatched yet
+		bool bWait = !bMore && (idle() || ActionWorkers);
+		size_t count = bWait ? Q->dequeueBatch(Actions, ACTION_BATCH_SIZE)
+							 : Q->tryDequeueBatch(Actions, ACTION_BATCH_SIZE);
+		if ((count == 0) && bWait)
+			break; // Stop()ped
+		for (size_t i = 0; i < count; i++)
+		{
+			TActionQueueItem *anAction = Actions[i];
+			if (anAction->bDone)
+			{
+				busy &= ~anAction->Resources;
+				anAction->Connection->bRunning[board] = false;
+				running--;
+				finish(anAction);
+				continue;
+			}
+			anAction->Resources = MessageResources(anAction->theMessage);
+			Lanes[anAction->Priority].push(anAction->Connection.get(), anAction,
+										   MessageCost(anAction->theMessage), anAction->Connection->Weight);
+		}
+		bMore = (count == ACTION_BATCH_SIZE);
+		if (bMore)
+			continue; // urgent ones may be among them; sort it all before choosing
+		Trace("---" + std::to_string(Lanes[priorityUrgent].size()) + " urgent, " +
+			  std::to_string(Lanes[priorityNormal].size()) + " SCHEDULED---");
+
+		__u64 now = NowNs();
+		if (!ActionWorkers)
+		{
+			TActionQueueItem *anAction = Lanes[Lanes[priorityUrgent].empty() ? priorityNormal : priorityUrgent].pop();
+			AddQueueWait(Waits[anAction->Priority], now - anAction->QueuedNs);
+			RunMessage(anAction->theMessage);
+			SendResponse(anAction->Connection, anAction->theMessage);
+			finish(anAction);
+		}
+		else
+		{
+			// start everything that can run; a Message held up by a resource reserves it against those behind it
+			TResourceMask reserved = busy;
+			auto eligible = [&](TActionQueueItem *anAction) {
+				if (anAction->Connection->bRunning[board])
+					return false;
+				if (anAction->Resources & reserved)
+				{
+					reserved |= anAction->Resources;
+					return false;
+				}
+				return true;
+			};
+			TActionQueueItem *anAction;
+			while ((running < ActionWorkers) &&
+				   (Lanes[priorityUrgent].pop(anAction, eligible) || Lanes[priorityNormal].pop(anAction, eligible)))
+			{
+				AddQueueWait(Waits[anAction->Priority], now - anAction->QueuedNs);
+				busy |= anAction->Resources;
+				reserved |= anAction->Resources;
+				anAction->Connection->bRunning[board] = true;
+				running++;
+				Pipeline->WorkQueue.enqueue(anAction);
+			}
+		}
+
+		if (now - lastReport >= ACTION_STATS_INTERVAL_NS)
+		{
+			LogQueueWaits(board, Waits);
+			lastReport = now;
+		}
 	}
+	LogQueueWaits(board, Waits);
+	for (int i = 0; i < ActionWorkers; i++)
+		Pipeline->WorkQueue.enqueue(nullptr);
+	for (int i = 0; i < ActionWorkers; i++)
+		pthread_join(workers[i], NULL);
+	return nullptr;
 }
 
 
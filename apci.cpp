@@ -1,32 +1,292 @@
+#include <errno.h>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "apci.h"
-#include "apcilib.h"
+#include "apci_device.h"
+#include "adc.h"
 #include "eNET-AIO16-16F.h"
 
-extern int apci;
-
 int widthFromOffset(int offset);
 
-__u8 in8(int offset)
+#pragma region boards
+static std::vector<TApciBoard *> Boards; // filled at startup, before any thread but main uses them
+static TApciBoard NoBoard(-1, nullptr);
+static thread_local TApciBoard *CurrentBoard = nullptr;
+
+TApciBoard *apciAddBoard(TApciDevice *device)
+{
+    if (Boards.size() >= APCI_MAX_BOARDS)
+    {
+        Error("already driving " + std::to_string(APCI_MAX_BOARDS) + " boards; ignoring " + device->Name());
+        delete device;
+        return nullptr;
+    }
+    Boards.push_back(new TApciBoard(Boards.size(), device));
+    return Boards.back();
+}
+
+void apciCloseBoards()
+{
+    for (auto board : Boards)
+        delete board;
+    Boards.clear();
+}
+
+int apciBoardCount() { return Boards.size(); }
+
+TApciBoard *apciBoard(int index) { return ((index >= 0) && (index < (int)Boards.size())) ? Boards[index] : nullptr; }
+
+void apciSetCurrentBoard(TApciBoard *board) { CurrentBoard = board; }
+
+TApciBoard *apciCurrentBoard()
+{
+    if (CurrentBoard)
+        return CurrentBoard;
+    return Boards.empty() ? &NoBoard : Boards[0];
+}
+
+TApciBoard::TApciBoard(int Index, TApciDevice *device) : Index(Index), Device(device), AdcStream(new TAdcStreamSession(this))
+{
+    if (Device)
+        Log("board " + std::to_string(Index) + " device backend: " + Device->Name());
+}
+
+TApciBoard::~TApciBoard()
+{
+    delete AdcStream; // stops the acquisition, which is still using Device
+    unmapRegisterBar();
+    delete Device;
+}
+#pragma endregion
+
+#pragma region mmap register backend
+#define FAKE_BAR_SIZE 0x100 // covers every eNET-AIO register offset
+#define IORESOURCE_MEM 0x00000200 // from linux/ioport.h; sysfs "resource" flags for a memory (mmap-able) BAR
+
+// MMIO ordering: device memory is already strongly ordered against itself, but register accesses must also be
+// ordered against normal memory (DMA buffers, flags other threads read), like the kernel's readl()/writel()
+#if defined(__aarch64__)
+#define mmio_rmb() asm volatile("dmb oshld" ::: "memory")
+#define mmio_wmb() asm volatile("dmb oshst" ::: "memory")
+#else
+#define mmio_rmb() asm volatile("" ::: "memory")
+#define mmio_wmb() asm volatile("" ::: "memory")
+#endif
+
+template <typename T> static inline bool barFits(int offset, size_t barSize)
+{
+    return (offset >= 0) && ((size_t)offset + sizeof(T) <= barSize);
+}
+
+template <typename T> static inline T mmioRead(volatile __u8 *bar, int offset)
+{
+    T value = *(volatile T *)(bar + offset);
+    mmio_rmb();
+    return value;
+}
+
+template <typename T> static inline void mmioWrite(volatile __u8 *bar, int offset, T value)
+{
+    mmio_wmb();
+    *(volatile T *)(bar + offset) = value;
+}
+
+volatile __u8 *TApciBoard::mapRegisterBar(size_t &size)
+{
+    unsigned int deviceID = 0;
+    unsigned long bars[6] = {};
+    if ((GetDeviceInfo(&deviceID, bars) < 0) || (bars[BAR_REGISTER] == 0))
+    {
+        Error("mmap registers: apci driver did not report BAR " + std::to_string(BAR_REGISTER));
+        return nullptr;
+    }
+
+    std::error_code ec;
+    for (const auto &dev : std::filesystem::directory_iterator("/sys/bus/pci/devices", ec))
+    {
+        std::ifstream resources(dev.path() / "resource");
+        unsigned long start = 0, end = 0, flags = 0;
+        for (int bar = 0; bar <= BAR_REGISTER; bar++)
+            resources >> std::hex >> start >> end >> flags;
+        if (!resources || (start != bars[BAR_REGISTER]))
+            continue;
+        if (!(flags & IORESOURCE_MEM))
+        {
+            Error("mmap registers: BAR " + std::to_string(BAR_REGISTER) + " of " + dev.path().string() + " is I/O space, not memory");
+            return nullptr;
+        }
+
+        std::string resource = (dev.path() / ("resource" + std::to_string(BAR_REGISTER))).string();
+        int fd = open(resource.c_str(), O_RDWR | O_SYNC);
+        if (fd < 0)
+        {
+            Error("mmap registers: open(" + resource + ") failed, errno: " + std::to_string(errno));
+            return nullptr;
+        }
+        size = end - start + 1;
+        void *bar = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd); // the mapping holds its own reference
+        if (bar == MAP_FAILED)
+        {
+            Error("mmap registers: mmap(" + resource + ") failed, errno: " + std::to_string(errno));
+            return nullptr;
+        }
+        Log("mmap registers: mapped " + resource + ", " + std::to_string(size) + " bytes");
+        return (volatile __u8 *)bar;
+    }
+    Error("mmap registers: no PCI device in sysfs has BAR " + std::to_string(BAR_REGISTER) + " @ " + to_hex<__u32>(bars[BAR_REGISTER]));
+    return nullptr;
+}
+
+void TApciBoard::unmapRegisterBar()
+{
+    if (RegisterBackend == rbMmap)
+        munmap((void *)RegisterBar, RegisterBarSize);
+    delete[] FakeBar;
+    FakeBar = nullptr;
+    RegisterBar = nullptr;
+    RegisterBarSize = 0;
+    RegisterBackend = rbIoctl;
+}
+
+TRegisterBackend TApciBoard::SelectRegisterBackend(TRegisterBackend preferred)
+{
+    unmapRegisterBar();
+    switch (preferred)
+    {
+    case rbFake:
+        FakeBar = new __u8[FAKE_BAR_SIZE]();
+        RegisterBar = FakeBar;
+        RegisterBarSize = FAKE_BAR_SIZE;
+        RegisterBackend = rbFake;
+        break;
+    case rbMmap:
+        RegisterBar = mapRegisterBar(RegisterBarSize);
+        if (RegisterBar)
+            RegisterBackend = rbMmap;
+        else
+            Error("mmap registers unavailable; falling back to ioctl register access");
+        break;
+    default:
+        break;
+    }
+    Log("board " + std::to_string(Index) + " register access backend: " + apciRegisterBackendName(RegisterBackend));
+    return RegisterBackend;
+}
+
+const char *apciRegisterBackendName(TRegisterBackend backend)
 {
+    switch (backend)
+    {
+    case rbMmap:
+        return "mmap";
+    case rbFake:
+        return "fake";
+    default:
+        return "ioctl";
+    }
+}
+#pragma endregion
+
+__u8 TApciBoard::In8(int offset)
+{
+    if (RegisterBar)
+        return barFits<__u8>(offset, RegisterBarSize) ? mmioRead<__u8>(RegisterBar, offset) : -1;
     __u8 value;
-    int status = apci_read8(apci, 0, BAR_REGISTER, offset, &value);
+    int status = Device ? Device->Read8(offset, &value) : -ENODEV;
     return status ? -1 : value;
 }
 
-__u16 in16(int offset)
+__u16 TApciBoard::In16(int offset)
 {
+    if (RegisterBar)
+        return barFits<__u16>(offset, RegisterBarSize) ? mmioRead<__u16>(RegisterBar, offset) : -1;
     __u16 value;
-    int status = apci_read16(apci, 0, BAR_REGISTER, offset, &value);
+    int status = Device ? Device->Read16(offset, &value) : -ENODEV;
     return status ? -1 : value;
 }
 
-__u32 in32(int offset)
+__u32 TApciBoard::In32(int offset)
 {
+    if (RegisterBar)
+        return barFits<__u32>(offset, RegisterBarSize) ? mmioRead<__u32>(RegisterBar, offset) : -1;
     __u32 value;
-    int status = apci_read32(apci, 0, BAR_REGISTER, offset, &value);
+    int status = Device ? Device->Read32(offset, &value) : -ENODEV;
     return status ? -1 : value;
 }
 
+TError TApciBoard::Out8(int offset, __u8 value)
+{
+    if (RegisterBar)
+    {
+        if (!barFits<__u8>(offset, RegisterBarSize))
+            return -1;
+        mmioWrite<__u8>(RegisterBar, offset, value);
+        return 0;
+    }
+    return Device ? Device->Write8(offset, value) : -ENODEV;
+}
+
+TError TApciBoard::Out16(int offset, __u16 value)
+{
+    if (RegisterBar)
+    {
+        if (!barFits<__u16>(offset, RegisterBarSize))
+            return -1;
+        mmioWrite<__u16>(RegisterBar, offset, value);
+        return 0;
+    }
+    return Device ? Device->Write16(offset, value) : -ENODEV;
+}
+
+TError TApciBoard::Out32(int offset, __u32 value)
+{
+    if (RegisterBar)
+    {
+        if (!barFits<__u32>(offset, RegisterBarSize))
+            return -1;
+        mmioWrite<__u32>(RegisterBar, offset, value);
+        return 0;
+    }
+    return Device ? Device->Write32(offset, value) : -ENODEV;
+}
+
+int TApciBoard::GetDevices() { return Device ? Device->GetDevices() : 0; }
+
+int TApciBoard::GetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]) { return Device ? Device->GetDeviceInfo(deviceID, bars) : -ENODEV; }
+
+int TApciBoard::WaitForIRQ() { return Device ? Device->WaitForIRQ() : -ENODEV; }
+
+int TApciBoard::CancelWaitForIRQ() { return Device ? Device->CancelWaitForIRQ() : -ENODEV; }
+
+int TApciBoard::DmaTransferSize(__u8 slots, size_t size) { return Device ? Device->DmaTransferSize(slots, size) : -ENODEV; }
+
+int TApciBoard::DmaDataReady(int *start_index, int *slots, int *data_discarded) { return Device ? Device->DmaDataReady(start_index, slots, data_discarded) : -ENODEV; }
+
+int TApciBoard::DmaDataDone(int slots) { return Device ? Device->DmaDataDone(slots) : -ENODEV; }
+
+int TApciBoard::StartDma() { return Device ? Device->StartDma() : -ENODEV; }
+
+void *TApciBoard::MapDmaBuffer(size_t size) { return Device ? Device->MapDmaBuffer(size) : nullptr; }
+
+void TApciBoard::UnmapDmaBuffer(void *buffer, size_t size)
+{
+    if (Device)
+        Device->UnmapDmaBuffer(buffer, size);
+}
+
+#pragma region current board
+__u8 in8(int offset) { return apciCurrentBoard()->In8(offset); }
+
+__u16 in16(int offset) { return apciCurrentBoard()->In16(offset); }
+
+__u32 in32(int offset) { return apciCurrentBoard()->In32(offset); }
+
 __u32 in(int offset)
 {
     switch (widthFromOffset(offset))
@@ -43,21 +303,11 @@ __u32 in(int offset)
     }
 }
 
+TError out8(int offset, __u8 value) { return apciCurrentBoard()->Out8(offset, value); }
 
-TError out8(int offset, __u8 value)
-{
-    return apci_write8(apci, 0, BAR_REGISTER, offset, value);
-}
-
-TError out16(int offset, __u16 value)
-{
-    return apci_write16(apci, 0, BAR_REGISTER, offset, value);
-}
+TError out16(int offset, __u16 value) { return apciCurrentBoard()->Out16(offset, value); }
 
-TError out32(int offset, __u32 value)
-{
-    return apci_write32(apci, 0, BAR_REGISTER, offset, value);
-}
+TError out32(int offset, __u32 value) { return apciCurrentBoard()->Out32(offset, value); }
 
 TError out(int offset, __u32 value)
 {
@@ -75,21 +325,26 @@ TError out(int offset, __u32 value)
     }
 }
 
-int apciGetDevices() { return apci_get_devices(apci); }
+int apciGetDevices() { return apciCurrentBoard()->GetDevices(); }
+
+int apciGetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]) { return apciCurrentBoard()->GetDeviceInfo(deviceID, bars); }
+
+int apciWaitForIRQ() { return apciCurrentBoard()->WaitForIRQ(); }
 
-int apciGetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]) { return apci_get_device_info(apci, 0, deviceID, bars); }
+int apciCancelWaitForIRQ() { return apciCurrentBoard()->CancelWaitForIRQ(); }
 
-int apciWaitForIRQ() { return apci_wait_for_irq(apci, 0); }
+int apciDmaTransferSize(__u8 slots, size_t size) { return apciCurrentBoard()->DmaTransferSize(slots, size); }
 
-int apciCancelWaitForIRQ() { return apci_cancel_irq(apci, 0); }
+int apciDmaDataReady(int *start_index, int *slots, int *data_discarded) { return apciCurrentBoard()->DmaDataReady(start_index, slots, data_discarded); }
 
-int apciDmaTransferSize(__u8 slots, size_t size) { return apci_dma_transfer_size(apci, 0, slots, size); }
+int apciDmaDataDone(int slots) { return apciCurrentBoard()->DmaDataDone(slots); }
 
-int apciDmaDataReady(int *start_index, int *slots, int *data_discarded) { return apci_dma_data_ready(apci, 0, start_index, slots, data_discarded); }
+int apciDmaStart() { return apciCurrentBoard()->StartDma(); }
 
-int apciDmaDataDone(int slots) { return apci_dma_data_done(apci, 0, slots); }
+void *apciMapDmaBuffer(size_t size) { return apciCurrentBoard()->MapDmaBuffer(size); }
 
-int apciDmaStart(){return apci_start_dma (apci);}
+void apciUnmapDmaBuffer(void *buffer, size_t size) { apciCurrentBoard()->UnmapDmaBuffer(buffer, size); }
+#pragma endregion
 
 // int apci_writebuf8(int fd, unsigned long device_index, int bar, int bar_offset, unsigned int mmap_offset, int length);
 // int apci_writebuf16(int fd, unsigned long device_index, int bar, int bar_offset, unsigned int mmap_offset, int length);
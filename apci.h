@@ -3,6 +3,87 @@
 #include "logging.h"
 #include "eNET-types.h"
 
+class TApciDevice;
+class TAdcStreamSession;
+
+#define APCI_MAX_BOARDS 8 // boards aioenetd will drive at once; TControlConnection keeps per-board state this wide
+
+/*
+	Register access backends for in()/out() and friends.
+	rbIoctl: one call into the TApciDevice per register access (an apcilib ioctl() for the real card); always available.
+	rbMmap:  BAR_REGISTER is mmap()ed from sysfs and accessed with volatile loads/stores; no syscall per access.
+	rbFake:  an in-process, zero-filled BAR for exercising the mmap path without hardware; writes read back as written.
+*/
+typedef enum { rbIoctl, rbMmap, rbFake } TRegisterBackend;
+
+const char *apciRegisterBackendName(TRegisterBackend backend);
+
+/*
+	One ACCES board: its device backend (see apci_device.h), how its registers are reached, and its ADC streaming
+	session.  Nothing about one board -- file descriptor, mapped BAR, DMA ring -- is shared with another.
+
+	aioenetd opens every board it finds with apciAddBoard() and drives each from its own action pipeline, whose
+	threads make it their current board (apciSetCurrentBoard()); the free functions below act on the calling
+	thread's current board, so DataItems reach whichever board their Message was sent to without being told.
+*/
+class TApciBoard
+{
+public:
+	// takes ownership of device
+	TApciBoard(int Index, TApciDevice *device);
+	~TApciBoard();
+
+	// picks the register backend; call once after the device is open, before any register access.
+	// rbMmap falls back to rbIoctl if the BAR cannot be mapped.  Returns the backend actually in use.
+	TRegisterBackend SelectRegisterBackend(TRegisterBackend preferred);
+	TRegisterBackend getRegisterBackend() { return RegisterBackend; }
+
+	__u8  In8(int offset);
+	__u16 In16(int offset);
+	__u32 In32(int offset);
+	TError Out8(int offset, __u8 value);
+	TError Out16(int offset, __u16 value);
+	TError Out32(int offset, __u32 value);
+
+	int GetDevices();
+	int GetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]);
+	int WaitForIRQ();
+	int CancelWaitForIRQ();
+	int DmaTransferSize(__u8 slots, size_t size);
+	int DmaDataReady(int *start_index, int *slots, int *data_discarded);
+	int DmaDataDone(int slots);
+	int StartDma();
+	void *MapDmaBuffer(size_t size);
+	void UnmapDmaBuffer(void *buffer, size_t size);
+
+	int Index; // in apciBoard() order; -1 for the stand-in used while no board is open
+	TApciDevice *Device;
+	TAdcStreamSession *AdcStream; // this board's one ADC acquisition and its subscribers
+
+protected:
+	// finds the sysfs PCI device whose BAR_REGISTER starts where the apci driver says this board's does, and maps it
+	volatile __u8 *mapRegisterBar(size_t &size);
+	void unmapRegisterBar();
+
+	TRegisterBackend RegisterBackend = rbIoctl;
+	volatile __u8 *RegisterBar = nullptr; // non-null only for rbMmap and rbFake
+	size_t RegisterBarSize = 0;
+	__u8 *FakeBar = nullptr; // rbFake's BAR, allocated on selection
+};
+
+// adds a board, numbered from 0 in the order added, and takes ownership of device; nullptr past APCI_MAX_BOARDS
+TApciBoard *apciAddBoard(TApciDevice *device);
+// deletes every board, closing their devices
+void apciCloseBoards();
+int apciBoardCount();
+// board index, or nullptr
+TApciBoard *apciBoard(int index);
+
+// the board the calling thread's register and DMA calls go to; a thread that never set one gets board 0 (or, with
+// no board open, a stand-in whose calls all fail with -ENODEV)
+void apciSetCurrentBoard(TApciBoard *board);
+TApciBoard *apciCurrentBoard();
+
 __u8  in8(int offset);
 __u16 in16(int offset);
 __u32 in32(int offset);
@@ -19,4 +100,7 @@ int apciCancelWaitForIRQ();
 int apciDmaTransferSize(__u8 slots, size_t size);
 int apciDmaDataReady(int *start_index, int *slots, int *data_discarded);
 int apciDmaDataDone(int slots);
-int apciDmaStart();
\ No newline at end of file
+int apciDmaStart();
+// read-only view of the whole DMA ring, or nullptr
+void *apciMapDmaBuffer(size_t size);
+void apciUnmapDmaBuffer(void *buffer, size_t size);
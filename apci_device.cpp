@@ -0,0 +1,53 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "apci_device.h"
+#include "apcilib.h"
+#include "eNET-AIO16-16F.h"
+
+#pragma region TApciFileDevice implementation
+TApciFileDevice::~TApciFileDevice()
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+int TApciFileDevice::Read8(int offset, __u8 *value) { return apci_read8(fd, 0, BAR_REGISTER, offset, value); }
+
+int TApciFileDevice::Read16(int offset, __u16 *value) { return apci_read16(fd, 0, BAR_REGISTER, offset, value); }
+
+int TApciFileDevice::Read32(int offset, __u32 *value) { return apci_read32(fd, 0, BAR_REGISTER, offset, value); }
+
+int TApciFileDevice::Write8(int offset, __u8 value) { return apci_write8(fd, 0, BAR_REGISTER, offset, value); }
+
+int TApciFileDevice::Write16(int offset, __u16 value) { return apci_write16(fd, 0, BAR_REGISTER, offset, value); }
+
+int TApciFileDevice::Write32(int offset, __u32 value) { return apci_write32(fd, 0, BAR_REGISTER, offset, value); }
+
+int TApciFileDevice::GetDevices() { return apci_get_devices(fd); }
+
+int TApciFileDevice::GetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]) { return apci_get_device_info(fd, 0, deviceID, bars); }
+
+int TApciFileDevice::WaitForIRQ() { return apci_wait_for_irq(fd, 0); }
+
+int TApciFileDevice::CancelWaitForIRQ() { return apci_cancel_irq(fd, 0); }
+
+int TApciFileDevice::DmaTransferSize(__u8 slots, size_t size) { return apci_dma_transfer_size(fd, 0, slots, size); }
+
+int TApciFileDevice::DmaDataReady(int *start_index, int *slots, int *data_discarded) { return apci_dma_data_ready(fd, 0, start_index, slots, data_discarded); }
+
+int TApciFileDevice::DmaDataDone(int slots) { return apci_dma_data_done(fd, 0, slots); }
+
+int TApciFileDevice::StartDma() { return apci_start_dma(fd); }
+
+void *TApciFileDevice::MapDmaBuffer(size_t size)
+{
+	void *buffer = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	return (buffer == MAP_FAILED) ? nullptr : buffer;
+}
+
+void TApciFileDevice::UnmapDmaBuffer(void *buffer, size_t size)
+{
+	munmap(buffer, size);
+}
+#pragma endregion
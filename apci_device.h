@@ -0,0 +1,82 @@
+#pragma once
+/*
+	Pluggable device backends behind the apci.h wrappers.
+
+	Everything aioenetd does to a card -- register reads/writes, IRQ waits, DMA ring bookkeeping, mapping the DMA
+	buffer -- goes through its TApciDevice, one per board, installed at startup with apciAddBoard().
+		TApciFileDevice: the real card, via the /dev/apci device file and apcilib's ioctl()s
+		TApciSimDevice:  a software model of the eNET-AIO16-16F (see apci_sim.h), for running without hardware
+
+	Methods return 0 or a negative errno, like apcilib; WaitForIRQ() also sets errno (ECANCELED when canceled) because
+	the ADC worker thread checks errno after apci_wait_for_irq().
+*/
+
+#include <cstddef>
+
+#include "eNET-types.h"
+
+class TApciDevice
+{
+public:
+	virtual ~TApciDevice() = default;
+
+	virtual const char *Name() = 0;
+
+	// BAR_REGISTER access; the access width must match widthFromOffset(offset) on real hardware
+	virtual int Read8(int offset, __u8 *value) = 0;
+	virtual int Read16(int offset, __u16 *value) = 0;
+	virtual int Read32(int offset, __u32 *value) = 0;
+	virtual int Write8(int offset, __u8 value) = 0;
+	virtual int Write16(int offset, __u16 value) = 0;
+	virtual int Write32(int offset, __u32 value) = 0;
+
+	virtual int GetDevices() = 0;
+	virtual int GetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]) = 0;
+
+	// blocks until the card raises an IRQ (a DMA slot completed) or CancelWaitForIRQ() is called
+	virtual int WaitForIRQ() = 0;
+	virtual int CancelWaitForIRQ() = 0;
+
+	// DMA ring: slots of size bytes each, filled by the card, handed to software by DmaDataReady()
+	virtual int DmaTransferSize(__u8 slots, size_t size) = 0;
+	virtual int DmaDataReady(int *start_index, int *slots, int *data_discarded) = 0;
+	virtual int DmaDataDone(int slots) = 0;
+	virtual int StartDma() = 0;
+	// read-only view of the whole DMA ring; nullptr on failure
+	virtual void *MapDmaBuffer(size_t size) = 0;
+	virtual void UnmapDmaBuffer(void *buffer, size_t size) = 0;
+};
+
+// the real card: an open /dev/apci/... file descriptor plus apcilib
+class TApciFileDevice : public TApciDevice
+{
+public:
+	// takes ownership of fd
+	TApciFileDevice(int fd) : fd(fd) {}
+	virtual ~TApciFileDevice();
+
+	virtual const char *Name() { return "apci device file"; }
+
+	virtual int Read8(int offset, __u8 *value);
+	virtual int Read16(int offset, __u16 *value);
+	virtual int Read32(int offset, __u32 *value);
+	virtual int Write8(int offset, __u8 value);
+	virtual int Write16(int offset, __u16 value);
+	virtual int Write32(int offset, __u32 value);
+
+	virtual int GetDevices();
+	virtual int GetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]);
+
+	virtual int WaitForIRQ();
+	virtual int CancelWaitForIRQ();
+
+	virtual int DmaTransferSize(__u8 slots, size_t size);
+	virtual int DmaDataReady(int *start_index, int *slots, int *data_discarded);
+	virtual int DmaDataDone(int slots);
+	virtual int StartDma();
+	virtual void *MapDmaBuffer(size_t size);
+	virtual void UnmapDmaBuffer(void *buffer, size_t size);
+
+protected:
+	int fd;
+};
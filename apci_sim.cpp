@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "apci_sim.h"
+#include "eNET-AIO16-16F.h"
+#include "logging.h"
+
+int widthFromOffset(int ofs);
+
+static __u64 nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#pragma region TApciSimDevice implementation
+TApciSimDevice::TApciSimDevice(double SampleRate) : SampleRate(SampleRate)
+{
+	Log("simulated eNET-AIO16-16F: " + std::to_string((int)SampleRate) + " samples/second");
+}
+
+TApciSimDevice::~TApciSimDevice()
+{
+	stopProducer();
+	CancelWaitForIRQ();
+	if (Ring)
+		munmap(Ring, RingSize);
+}
+
+#pragma region registers
+int TApciSimDevice::checkAccess(int offset, int width)
+{
+	if ((offset < 0) || (offset + width / 8 > (int)sizeof(Space)) || (widthFromOffset(offset) != width))
+	{
+		Error("simulated register access of width " + std::to_string(width) + " at invalid offset +" + to_hex<__u8>(offset));
+		return -EINVAL;
+	}
+	return 0;
+}
+
+__u32 TApciSimDevice::readRegister(int offset, int width)
+{
+	switch (offset)
+	{
+	case ofsFpgaID:
+		return SIM_FPGA_ID;
+	case ofsDeviceID:
+		return SIM_DEVICE_ID;
+	case ofsAdcBaseClock:
+		return AdcBaseClock;
+	}
+
+	std::lock_guard<std::mutex> lock(RegisterLock);
+	__u32 value = 0;
+	memcpy(&value, Space + offset, width / 8);
+	if ((offset == ofsDacSpiBusy) && (nowNs() < DacBusyUntil))
+		value |= bmDacSpiBusy;
+	if ((offset == ofsDioSpiBusy) && (nowNs() < DioBusyUntil))
+		value |= bmDioSpiBusy;
+	return value;
+}
+
+void TApciSimDevice::writeRegister(int offset, int width, __u32 value)
+{
+	switch (offset)
+	{
+	case ofsFpgaID:
+	case ofsDeviceID:
+	case ofsAdcBaseClock:
+		return; // read-only
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(RegisterLock);
+		switch (offset)
+		{
+		case ofsDac:
+			value &= ~bmDacSpiBusy;
+			DacBusyUntil = nowNs() + SIM_SPI_BUSY_NS;
+			break;
+		case ofsDioDirections:
+			value &= ~bmDioSpiBusy;
+			// fall through
+		case ofsDioOutputs:
+			DioBusyUntil = nowNs() + SIM_SPI_BUSY_NS;
+			break;
+		}
+		memcpy(Space + offset, &value, width / 8);
+	}
+
+	// stopping joins the producer, which takes RegisterLock; so only after releasing it
+	if ((offset == ofsAdcTriggerOptions) && (value == 0))
+		stopProducer();
+}
+
+int TApciSimDevice::Read8(int offset, __u8 *value)
+{
+	int status = checkAccess(offset, 8);
+	if (status == 0)
+		*value = readRegister(offset, 8);
+	return status;
+}
+
+int TApciSimDevice::Read16(int offset, __u16 *value)
+{
+	int status = checkAccess(offset, 16);
+	if (status == 0)
+		*value = readRegister(offset, 16);
+	return status;
+}
+
+int TApciSimDevice::Read32(int offset, __u32 *value)
+{
+	int status = checkAccess(offset, 32);
+	if (status == 0)
+		*value = readRegister(offset, 32);
+	return status;
+}
+
+int TApciSimDevice::Write8(int offset, __u8 value)
+{
+	int status = checkAccess(offset, 8);
+	if (status == 0)
+		writeRegister(offset, 8, value);
+	return status;
+}
+
+int TApciSimDevice::Write16(int offset, __u16 value)
+{
+	int status = checkAccess(offset, 16);
+	if (status == 0)
+		writeRegister(offset, 16, value);
+	return status;
+}
+
+int TApciSimDevice::Write32(int offset, __u32 value)
+{
+	int status = checkAccess(offset, 32);
+	if (status == 0)
+		writeRegister(offset, 32, value);
+	return status;
+}
+
+int TApciSimDevice::GetDevices() { return 1; }
+
+int TApciSimDevice::GetDeviceInfo(unsigned int *deviceID, unsigned long bars[6])
+{
+	*deviceID = SIM_DEVICE_ID;
+	for (int i = 0; i < 6; i++)
+		bars[i] = 0; // nothing to mmap; the register backend stays on the device calls
+	return 0;
+}
+#pragma endregion
+
+#pragma region IRQ and DMA
+int TApciSimDevice::WaitForIRQ()
+{
+	std::unique_lock<std::mutex> lock(RingLock);
+	// an IRQ (or cancel) raised since the last wait returned is latched, not lost
+	IrqRaised.wait(lock, [&] { return bIrqPending || bCancelPending; });
+	bIrqPending = false;
+	if (bCancelPending)
+	{
+		bCancelPending = false;
+		errno = ECANCELED;
+		return -ECANCELED;
+	}
+	return 0;
+}
+
+int TApciSimDevice::CancelWaitForIRQ()
+{
+	{
+		std::lock_guard<std::mutex> lock(RingLock);
+		bCancelPending = true;
+	}
+	IrqRaised.notify_all();
+	return 0;
+}
+
+int TApciSimDevice::DmaTransferSize(__u8 slots, size_t size)
+{
+	if (bRunning)
+		return -EBUSY;
+	if ((slots == 0) || (size == 0) || (size % sizeof(__u32)))
+		return -EINVAL;
+
+	std::lock_guard<std::mutex> lock(RingLock);
+	if (slots * size > RingSize)
+	{
+		if (Ring)
+			munmap(Ring, RingSize);
+		RingSize = slots * size;
+		void *ring = mmap(NULL, RingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		Ring = (ring == MAP_FAILED) ? nullptr : (__u8 *)ring;
+		if (!Ring)
+		{
+			RingSize = 0;
+			return -ENOMEM;
+		}
+	}
+	SlotCount = slots;
+	SlotSize = size;
+	FirstFull = FullSlots = Discarded = 0;
+	return 0;
+}
+
+int TApciSimDevice::DmaDataReady(int *start_index, int *slots, int *data_discarded)
+{
+	std::lock_guard<std::mutex> lock(RingLock);
+	*start_index = FirstFull;
+	*slots = FullSlots;
+	*data_discarded = Discarded;
+	Discarded = 0;
+	return 0;
+}
+
+int TApciSimDevice::DmaDataDone(int slots)
+{
+	std::lock_guard<std::mutex> lock(RingLock);
+	if ((slots < 0) || (slots > FullSlots))
+		return -EINVAL;
+	FirstFull = (FirstFull + slots) % SlotCount;
+	FullSlots -= slots;
+	return 0;
+}
+
+int TApciSimDevice::StartDma()
+{
+	if (!Ring)
+		return -EINVAL;
+	if (bRunning)
+		return 0;
+	{
+		std::lock_guard<std::mutex> lock(RingLock);
+		FirstFull = FullSlots = Discarded = 0;
+		bIrqPending = false;
+		bCancelPending = false; // a cancel aimed at an earlier stream
+	}
+	bRunning = true;
+	if (0 != pthread_create(&Producer, NULL, &TApciSimDevice::ProducerThread, this))
+	{
+		bRunning = false;
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+void *TApciSimDevice::MapDmaBuffer(size_t size)
+{
+	std::lock_guard<std::mutex> lock(RingLock);
+	return (size <= RingSize) ? Ring : nullptr;
+}
+
+void TApciSimDevice::UnmapDmaBuffer(void *buffer, size_t size)
+{
+	// the ring belongs to the device and lives until it is destroyed
+}
+
+void TApciSimDevice::stopProducer()
+{
+	if (bRunning.exchange(false))
+		pthread_join(Producer, NULL);
+}
+
+void *TApciSimDevice::ProducerThread(void *arg)
+{
+	((TApciSimDevice *)arg)->produce();
+	return nullptr;
+}
+
+void TApciSimDevice::produce()
+{
+	Trace("simulated DMA producer started");
+	__u64 slotNs = (__u64)(1e9 * (SlotSize / sizeof(__u32)) / SampleRate);
+	__u64 due = nowNs() + slotNs;
+	while (bRunning)
+	{
+		struct timespec ts = {(time_t)(due / 1000000000ull), (long)(due % 1000000000ull)};
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		// catch up if we overslept, so the long-run rate is SampleRate regardless of scheduling jitter
+		for (__u64 now = nowNs(); bRunning && (due <= now); due += slotNs)
+		{
+			int slot;
+			{
+				std::lock_guard<std::mutex> lock(RingLock);
+				if (FullSlots == SlotCount)
+				{
+					Discarded++; // ring overrun: software isn't keeping up
+					continue;
+				}
+				slot = (FirstFull + FullSlots) % SlotCount;
+			}
+			fillSlot((__u32 *)(Ring + slot * SlotSize));
+			{
+				std::lock_guard<std::mutex> lock(RingLock);
+				FullSlots++;
+				bIrqPending = true;
+			}
+			IrqRaised.notify_all();
+		}
+	}
+	Trace("simulated DMA producer stopped");
+}
+
+void TApciSimDevice::fillSlot(__u32 *slot)
+{
+	int first, last;
+	{
+		std::lock_guard<std::mutex> lock(RegisterLock);
+		first = Space[ofsAdcStartChannel] & 0x7F;
+		last = Space[ofsAdcStopChannel] & 0x7F;
+	}
+	if (last < first)
+		last = first;
+	int channels = last - first + 1;
+
+	for (size_t i = 0; i < SlotSize / sizeof(__u32); i++, SampleIndex++)
+	{
+		__u32 channel = first + SampleIndex % channels;
+		__u32 counts = (SampleIndex / channels * (channel + 1) * 16) & bmAdcDataMask;
+		slot[i] = (channel << 20) | counts;
+	}
+}
+#pragma endregion
+#pragma endregion
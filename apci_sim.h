@@ -0,0 +1,94 @@
+#pragma once
+/*
+	Software model of an eNET-AIO16-16F, for running aioenetd -- including ADC streaming -- without hardware.
+
+	Registers follow widthFromOffset(): +00..+17 are byte-wide, +18..+FC are 32-bit on 4-byte boundaries, and an
+	access of the wrong width fails with -EINVAL, as the driver would.  Registers otherwise read back what was written,
+	except:
+		ofsFpgaID, ofsDeviceID, ofsAdcBaseClock: read-only identification values
+		ofsDac, ofsDioOutputs/ofsDioDirections: a write starts an SPI transaction; bmDacSpiBusy/bmDioSpiBusy read as
+			set until it would have finished
+		ofsAdcTriggerOptions: writing 0 stops the ADC (and so the simulated DMA)
+
+	DMA: once StartDma() is called a producer thread fills ring slots with synthetic samples (channel number in
+	bmAdcDataChannelMask, a per-channel sawtooth in bmAdcDataMask) at SampleRate samples/second, across the channels
+	set by ofsAdcStartChannel/ofsAdcStopChannel, and raises an IRQ per slot.  When software falls behind and the
+	ring is full, slots are discarded and reported through DmaDataReady()'s data_discarded, like the driver does.
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+
+#include "apci_device.h"
+
+#define SIM_FPGA_ID 0x00010005
+#define SIM_DEVICE_ID 0x86E2
+#define SIM_SPI_BUSY_NS 2000		// one 24-bit SPI transaction to the DAC or DIO shift registers
+#define SIM_DEFAULT_SAMPLE_RATE 1000000 // samples/second, all channels combined
+
+class TApciSimDevice : public TApciDevice
+{
+public:
+	TApciSimDevice(double SampleRate = SIM_DEFAULT_SAMPLE_RATE);
+	virtual ~TApciSimDevice();
+
+	virtual const char *Name() { return "simulated eNET-AIO16-16F"; }
+
+	virtual int Read8(int offset, __u8 *value);
+	virtual int Read16(int offset, __u16 *value);
+	virtual int Read32(int offset, __u32 *value);
+	virtual int Write8(int offset, __u8 value);
+	virtual int Write16(int offset, __u16 value);
+	virtual int Write32(int offset, __u32 value);
+
+	virtual int GetDevices();
+	virtual int GetDeviceInfo(unsigned int *deviceID, unsigned long bars[6]);
+
+	virtual int WaitForIRQ();
+	virtual int CancelWaitForIRQ();
+
+	virtual int DmaTransferSize(__u8 slots, size_t size);
+	virtual int DmaDataReady(int *start_index, int *slots, int *data_discarded);
+	virtual int DmaDataDone(int slots);
+	virtual int StartDma();
+	virtual void *MapDmaBuffer(size_t size);
+	virtual void UnmapDmaBuffer(void *buffer, size_t size);
+
+	double SampleRate;
+
+protected:
+	// widthFromOffset() check shared by every register access
+	int checkAccess(int offset, int width);
+	__u32 readRegister(int offset, int width);
+	void writeRegister(int offset, int width, __u32 value);
+	void stopProducer();
+	static void *ProducerThread(void *arg);
+	void produce();
+	void fillSlot(__u32 *slot);
+
+	std::mutex RegisterLock;
+	__u8 Space[0x100] = {}; // BAR_REGISTER contents, little-endian
+	__u64 DacBusyUntil = 0; // CLOCK_MONOTONIC ns
+	__u64 DioBusyUntil = 0;
+
+	// DMA ring; the producer owns slot contents, RingLock guards the indices
+	std::mutex RingLock;
+	std::condition_variable IrqRaised;
+	__u8 *Ring = nullptr;
+	size_t RingSize = 0;
+	int SlotCount = 0;
+	size_t SlotSize = 0;
+	int FirstFull = 0;  // oldest slot not yet DmaDataDone()'d
+	int FullSlots = 0;
+	int Discarded = 0; // since the last DmaDataReady()
+	bool bIrqPending = false; // latched until the next WaitForIRQ() returns, like the card's IRQ status
+	// a cancel is held until the next WaitForIRQ() consumes it, so one issued while the ADC worker is busy copying
+	// slots still stops it
+	bool bCancelPending = false;
+
+	pthread_t Producer;
+	std::atomic<bool> bRunning{false};
+	__u64 SampleIndex = 0;
+};
@@ -0,0 +1,269 @@
+/*
+	ADC streaming cost: starts aioenetd on a simulated board (AIOENETD_DEVICE=sim), streams to one TCP ADC connection
+	for a few seconds, and reports the MB/s received and CPU time per MB: the sender thread's, and the whole daemon's,
+	which includes the simulator's.  It does so once with plain send() and once
+	with AIOENETD_ADC_MSG_ZEROCOPY=1.  Over loopback the kernel copies every MSG_ZEROCOPY send, so only a real NIC
+	shows its win.
+
+	The daemon is $AIOENETD if set, else ./aioenetd; its output goes to bench/adc_stream.log, line-buffered if
+	stdbuf(1) is installed.
+
+	With --max-rate it instead finds the highest simulated sample rate (AIOENETD_SIM_RATE) one plain-send() stream
+	sustains: all of it delivered, no DMA ring overrun ("data_discarded" in the log) and no blocks dropped for lagging.
+	Given a rate too, it only checks that one, and exits 0 if it is sustained.
+
+	make aioenetd bench/adc_stream && bench/adc_stream [seconds [samples/s]]
+	make aioenetd bench/adc_stream && bench/adc_stream --max-rate [seconds [samples/s]]
+*/
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "bench.h"
+#include "../TMessage.h"
+
+#define CONTROL_PORT 18767
+#define ADC_PORT 18768
+#define DAEMON_LOG "bench/adc_stream.log"
+#define SENDER_THREAD "adc-send" // what TAdcStreamSession::SenderThread() names itself
+
+struct TStreamResult
+{
+	double Bytes, Seconds, CpuSeconds, SenderCpuSeconds;
+};
+
+// starts the daemon with env added to ours; its pid, or -1
+static pid_t StartDaemon(const std::vector<std::string> &env)
+{
+	const char *daemon = getenv("AIOENETD") ? getenv("AIOENETD") : "./aioenetd";
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+	int log = open(DAEMON_LOG, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (log >= 0)
+	{
+		dup2(log, STDOUT_FILENO);
+		dup2(log, STDERR_FILENO);
+	}
+	for (auto &var : env)
+		putenv(strdup(var.c_str()));
+	execlp("stdbuf", "stdbuf", "-oL", daemon, (char *)nullptr); // its log is lost unflushed when it's stopped otherwise
+	execl(daemon, daemon, (char *)nullptr);
+	perror(daemon);
+	_exit(127);
+}
+
+static void StopDaemon(pid_t pid)
+{
+	kill(pid, SIGINT);
+	for (int i = 0; i < 50; i++)
+	{
+		usleep(100000);
+		if (waitpid(pid, nullptr, WNOHANG) == pid)
+			return;
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+}
+
+// a TCP connection to the daemon's port, retried while it starts up; -1 if it never listens
+static int Connect(int port)
+{
+	for (int i = 0; i < 50; i++)
+	{
+		int s = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			return s;
+		close(s);
+		usleep(100000);
+	}
+	return -1;
+}
+
+static bool ReadAll(int s, void *buf, size_t length)
+{
+	for (size_t got = 0; got < length;)
+	{
+		ssize_t n = recv(s, (__u8 *)buf + got, length - got, 0);
+		if (n <= 0)
+			return false;
+		got += n;
+	}
+	return true;
+}
+
+// the next Message on a Control connection; its MId, or 0 if the connection failed
+static TMessageId ReadMessage(int s)
+{
+	__u8 header[5];
+	if (!ReadAll(s, header, sizeof(header)))
+		return 0;
+	TMessagePayloadSize length;
+	memcpy(&length, header + 1, sizeof(length));
+	TBytes rest(PAYLOAD_SIZE(length) + 1); // and the checksum
+	return ReadAll(s, rest.data(), rest.size()) ? header[0] : 0;
+}
+
+// sends a Message and checks that its Response isn't an error
+static bool Command(int s, const TBytes &message)
+{
+	return send(s, message.data(), message.size(), MSG_NOSIGNAL) == (ssize_t)message.size() && ReadMessage(s) == 'R';
+}
+
+// CPU time of pid's threads named name, or of all of them if name is null, in seconds; from each thread's schedstat,
+// whose first field is its time on a CPU in ns, since the tick counts in stat are too coarse for a few seconds' run
+static double CpuSeconds(pid_t pid, const char *name = nullptr)
+{
+	double ns = 0;
+	std::error_code ec;
+	for (auto &task : std::filesystem::directory_iterator("/proc/" + std::to_string(pid) + "/task", ec))
+	{
+		std::ifstream comm(task.path() / "comm"), schedstat(task.path() / "schedstat");
+		std::string taskName;
+		double taskNs;
+		if (std::getline(comm, taskName) && (name == nullptr || taskName == name) && (schedstat >> taskNs))
+			ns += taskNs;
+	}
+	return ns / 1e9;
+}
+
+// streams for seconds from a daemon started with env; false if it couldn't be started or streamed from
+static bool Stream(const std::vector<std::string> &env, double seconds, TStreamResult &result)
+{
+	pid_t pid = StartDaemon(env);
+	int control = pid > 0 ? Connect(CONTROL_PORT) : -1;
+	int adc = control >= 0 ? Connect(ADC_PORT) : -1;
+	__u32 hello = 0;
+	bool bStreaming = adc >= 0 && ReadMessage(control) && ReadAll(adc, &hello, sizeof(hello));
+	__u32 connectionId = hello & 0x7FFFFFFF;
+	TBytes id{(__u8)connectionId, (__u8)(connectionId >> 8), (__u8)(connectionId >> 16), (__u8)(connectionId >> 24)};
+	bStreaming = bStreaming && Command(control, BenchMessage({{ADC_StreamStart, id}}, 'C'));
+
+	result = {0, 0, 0, 0};
+	if (bStreaming)
+	{
+		static __u8 buf[1 << 16];
+		double cpuBefore = CpuSeconds(pid), senderCpuBefore = CpuSeconds(pid, SENDER_THREAD);
+		auto start = std::chrono::steady_clock::now();
+		while ((result.Seconds = NsSince(start) / 1e9) < seconds)
+		{
+			ssize_t n = recv(adc, buf, sizeof(buf), 0);
+			if (n <= 0)
+			{
+				bStreaming = false;
+				break;
+			}
+			result.Bytes += n;
+		}
+		result.CpuSeconds = CpuSeconds(pid) - cpuBefore;
+		result.SenderCpuSeconds = CpuSeconds(pid, SENDER_THREAD) - senderCpuBefore;
+		Command(control, BenchMessage({{ADC_StreamStop, {}}}, 'C'));
+	}
+	if (adc >= 0)
+		close(adc);
+	if (control >= 0)
+		close(control);
+	if (pid > 0)
+		StopDaemon(pid);
+	return bStreaming;
+}
+
+// whether the last daemon's log reports a DMA ring overrun, or blocks dropped for a lagging subscriber
+static bool Overran()
+{
+	std::ifstream log(DAEMON_LOG);
+	for (std::string line; std::getline(log, line);)
+	{
+		size_t dropped = line.find(" blocks dropped");
+		if (line.find("data_discarded:") != std::string::npos ||
+			(dropped != std::string::npos && line.compare(dropped - 2, 2, ", ") && line[dropped - 1] != '0'))
+			return true;
+	}
+	return false;
+}
+
+// a rate is sustainable if the stream delivers it and nothing overruns
+static bool Sustains(double rate, double seconds)
+{
+	std::vector<std::string> env{"AIOENETD_DEVICE=sim", "AIOENETD_REGISTERS=ioctl",
+								 "AIOENETD_SIM_RATE=" + std::to_string(rate)};
+	TStreamResult result;
+	bool bStreamed = Stream(env, seconds, result);
+	double MBps = result.Bytes / 1e6 / std::max(result.Seconds, 1e-9), expected = rate * sizeof(__u32) / 1e6;
+	bool bOverran = Overran();
+	bool bSustains = bStreamed && !bOverran && MBps >= 0.97 * expected;
+	printf("%8.3g samples/s  %7.1f of %7.1f MB/s%s  %s\n", rate, MBps, expected, bOverran ? ", overran" : "",
+		   bSustains ? "ok" : "not sustained");
+	return bSustains;
+}
+
+// the highest simulated sample rate a stream sustains: doubles the rate until it fails, then bisects 4 times
+static void MaxRate(double seconds)
+{
+	double low = 0, high = 8e6;
+	while (Sustains(high, seconds))
+		low = high, high *= 2;
+	for (int i = 0; i < 4; i++)
+	{
+		double mid = (low + high) / 2;
+		if (Sustains(mid, seconds))
+			low = mid;
+		else
+			high = mid;
+	}
+	printf("highest sustained: %.3g samples/s (%.0f MB/s)\n", low, low * sizeof(__u32) / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "--max-rate"))
+	{
+		double seconds = argc > 2 ? atof(argv[2]) : 3;
+		if (argc > 3)
+			return Sustains(atof(argv[3]), seconds) ? 0 : 1;
+		MaxRate(seconds);
+		return 0;
+	}
+	double seconds = argc > 1 ? atof(argv[1]) : 3;
+	std::string rate = argc > 2 ? argv[2] : "4e6";
+	std::vector<std::string> sim{"AIOENETD_DEVICE=sim", "AIOENETD_REGISTERS=ioctl", "AIOENETD_SIM_RATE=" + rate};
+	struct
+	{
+		const char *name;
+		const char *env;
+	} modes[] = {
+		{"plain send()", "AIOENETD_ADC_MSG_ZEROCOPY=0"},
+		{"MSG_ZEROCOPY", "AIOENETD_ADC_MSG_ZEROCOPY=1"},
+	};
+	printf("%s samples/s, %.0f s per run\n", rate.c_str(), seconds);
+	for (auto &mode : modes)
+	{
+		auto env = sim;
+		env.push_back(mode.env);
+		TStreamResult result;
+		if (!Stream(env, seconds, result))
+		{
+			printf("%s: couldn't stream; see " DAEMON_LOG "\n", mode.name);
+			return 1;
+		}
+		double MB = result.Bytes / 1e6;
+		printf("%-13s %7.1f MB/s  CPU per MB: sender %5.0f us, whole daemon %6.0f us\n", mode.name, MB / result.Seconds,
+			   result.SenderCpuSeconds * 1e6 / MB, result.CpuSeconds * 1e6 / MB);
+	}
+}
@@ -0,0 +1,81 @@
+/*
+	Heap allocations per Message: parsing it into a TMessageArena, serializing it with writeTo(), and serializing it
+	with AsBytes() on the Message and on each DataItem.  Counted by replacing the global operator new, so anything
+	the arena serves from its own buffer doesn't count.  Log() calls made along the way count (they allocate in the
+	daemon too), but what they print is thrown away; the table goes to stderr.
+
+	make bench/alloc && bench/alloc
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "bench.h"
+#include "../TMessage.h"
+#include "../message_arena.h"
+
+#define MESSAGES 4000
+
+static std::atomic<long> allocations{0};
+
+static void *CountedAlloc(size_t size)
+{
+	allocations++;
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return CountedAlloc(size); }
+void *operator new[](size_t size) { return CountedAlloc(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+int main()
+{
+	struct
+	{
+		const char *name;
+		TBytes bytes;
+	} cases[] = {
+		{"1 x REG_Read1", BenchMessage(BenchRepeat(1, REG_Read1, {0x00}))},
+		{"16 x REG_Read1", BenchMessage(BenchRepeat(16, REG_Read1, {0x00}))},
+		{"16 x REG_Write1", BenchMessage(BenchRepeat(16, REG_Write1, {0x40, 1, 2, 3, 4}))},
+		{"16 x DAC_Range1", BenchMessage(BenchRepeat(16, DAC_Range1, {1, 0, 0, 0, 0}))},
+	};
+	TBytes reply(65536);
+	if (!freopen("/dev/null", "w", stdout))
+		return 1;
+	fprintf(stderr, "allocations per Message  %8s %8s %8s\n", "parse", "writeTo", "AsBytes");
+	for (auto &c : cases)
+	{
+		long parse = 0, write = 0, asBytes = 0;
+		for (int i = 0; i < MESSAGES; i++)
+		{
+			auto *arena = new TMessageArena();
+			TError result;
+			long before = allocations;
+			TMessage *msg = arena->make<TMessage>(TMessage::FromBytes(TBytesView(c.bytes), result, arena));
+			long parsed = allocations;
+			if (msg->encodedSize(true) <= reply.size())
+				msg->writeTo(reply.data(), true);
+			long written = allocations;
+			{
+				TBytes bytes = msg->AsBytes(true);
+				for (auto &item : msg->DataItems)
+					item.AsBytes(true);
+			}
+			parse += parsed - before;
+			write += written - parsed;
+			asBytes += allocations - written;
+			TMessageArena::destroy(msg);
+			delete arena;
+		}
+		fprintf(stderr, "%-24s %8.2f %8.2f %8.2f\n", c.name, (double)parse / MESSAGES, (double)write / MESSAGES,
+			   (double)asBytes / MESSAGES);
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+/*
+	Shared by the bench/ programs.  Each one is a single translation unit, built by its own Makefile target, and most
+	are linked with the daemon's sources except aioenetd.cpp (BENCH_SRCS), so this defines the global they need from
+	it.  Numbers are best-of-REPEATS, to keep a noisy host's outliers out of them.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include "../config.h"
+#include "../eNET-types.h"
+#include "../DataItems/TDataItem.h"
+
+TConfig Config;
+
+#define REPEATS 5
+
+typedef std::vector<std::pair<DataItemIds, TBytes>> TBenchItems;
+
+// a Protocol 2 Message: MId, payload length, then each DataItem's DId, data length and data, then the checksum,
+// which is wrong if bBadChecksum
+static TBytes BenchMessage(const TBenchItems &items, TMessageId MId = 'Q', bool bBadChecksum = false)
+{
+	TBytes bytes{(__u8)MId};
+	__u32 length = 0;
+	for (auto &item : items)
+		length += 4 + item.second.size();
+	for (int i = 0; i < 4; i++)
+		bytes.push_back((length >> (8 * i)) & 0xFF);
+	for (auto &item : items)
+	{
+		bytes.push_back(item.first & 0xFF);
+		bytes.push_back(item.first >> 8);
+		bytes.push_back(item.second.size() & 0xFF);
+		bytes.push_back(item.second.size() >> 8);
+		bytes.insert(bytes.end(), item.second.begin(), item.second.end());
+	}
+	__u8 sum = 0;
+	for (auto byte : bytes)
+		sum += byte;
+	bytes.push_back((__u8)(0 - sum + (bBadChecksum ? 1 : 0)));
+	return bytes;
+}
+
+// count copies of one DataItem
+static TBenchItems BenchRepeat(int count, DataItemIds DId, TBytes data)
+{
+	return TBenchItems(count, {DId, data});
+}
+
+static double NsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the fastest of REPEATS runs of run(), which returns ns per operation
+template <class Run>
+static double BestOf(Run run)
+{
+	double best = run();
+	for (int i = 1; i < REPEATS; i++)
+		best = std::min(best, run());
+	return best;
+}
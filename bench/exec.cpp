@@ -0,0 +1,70 @@
+/*
+	Executing a 16 x REG_Read1 bundle (8 8-bit and 8 32-bit registers) on a simulated board with the rbFake register
+	backend, so it times the DataItems' dispatch and the register access path rather than a syscall: Go() on every
+	DataItem, Go() plus serializing the Response with encodedSize() and writeTo(), and the whole of parse, Go(),
+	serialize and free, in ns per Message.
+
+	make bench/exec && bench/exec
+*/
+
+#include <cstdio>
+
+#include "bench.h"
+#include "../TMessage.h"
+#include "../message_arena.h"
+#include "../apci.h"
+#include "../apci_sim.h"
+
+#define MESSAGES 200000
+
+struct TExecNs
+{
+	double Go, GoAndSerialize, All;
+};
+
+static TExecNs ExecNs(const TBytes &bytes)
+{
+	TBytes reply(4096);
+	double go = 0, goAndSerialize = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < MESSAGES; i++)
+	{
+		TMessageArena arena;
+		TError result;
+		TMessage *msg = arena.make<TMessage>(TMessage::FromBytes(TBytesView(bytes), result, &arena));
+		auto executing = std::chrono::steady_clock::now();
+		for (auto &item : msg->DataItems)
+			item.Go();
+		go += NsSince(executing);
+		if (msg->encodedSize(true) <= reply.size())
+			msg->writeTo(reply.data(), true);
+		goAndSerialize += NsSince(executing);
+		TMessageArena::destroy(msg);
+	}
+	return {go / MESSAGES, goAndSerialize / MESSAGES, NsSince(start) / MESSAGES};
+}
+
+int main()
+{
+	TApciBoard *board = apciAddBoard(new TApciSimDevice());
+	if (board->SelectRegisterBackend(rbFake) != rbFake)
+	{
+		printf("couldn't select the fake register backend\n");
+		return 1;
+	}
+	apciSetCurrentBoard(board);
+
+	TBenchItems items;
+	for (int i = 0; i < 16; i++)
+		items.push_back({REG_Read1, {(__u8)(i < 8 ? i : 0x40 + 4 * (i - 8))}});
+	TBytes bytes = BenchMessage(items);
+
+	TExecNs best = ExecNs(bytes);
+	for (int i = 1; i < REPEATS; i++)
+	{
+		TExecNs ns = ExecNs(bytes);
+		best = {std::min(best.Go, ns.Go), std::min(best.GoAndSerialize, ns.GoAndSerialize), std::min(best.All, ns.All)};
+	}
+	printf("16 x REG_Read1: Go() %.0f ns, Go() + serialize %.0f ns, parse + Go() + serialize + free %.0f ns\n",
+		   best.Go, best.GoAndSerialize, best.All);
+}
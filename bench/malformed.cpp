@@ -0,0 +1,64 @@
+/*
+	Parse cost of malformed input: parsing and freeing a mix of Messages in which 1 in 10 is malformed, and the
+	malformed ones alone, in ns per Message.  The malformed ones are a REG_Read1 of a bad offset, a REG_Write1 of a
+	32-bit value to an 8-bit register, DAC channel 7, and a bad checksum.  The parser's error logging is included in
+	the timings, but what it prints is thrown away; the results go to stderr.
+
+	make bench/malformed && bench/malformed
+*/
+
+#include <cstdio>
+
+#include "bench.h"
+#include "../TMessage.h"
+#include "../message_arena.h"
+
+#define ROUNDS 20000
+
+// ns per Message to parse and free every one of messages, ROUNDS times; counts those that don't parse in errors
+static double ParseNs(const std::vector<const TBytes *> &messages, long &errors)
+{
+	errors = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ROUNDS; i++)
+		for (auto *bytes : messages)
+		{
+			TMessageArena arena;
+			TError result;
+			TMessage *msg = arena.make<TMessage>(TMessage::FromBytes(TBytesView(*bytes), result, &arena));
+			errors += result != ERR_SUCCESS;
+			TMessageArena::destroy(msg);
+		}
+	return NsSince(start) / ROUNDS / messages.size();
+}
+
+int main()
+{
+	std::vector<TBytes> good{
+		BenchMessage({{REG_Read1, {0x00}}, {REG_Read1, {0x40}}, {REG_Read1, {0x10}}, {REG_Read1, {0x44}}}),
+		BenchMessage({{REG_Write1, {0x40, 1, 2, 3, 4}}, {REG_Read1, {0x40}}}),
+	};
+	std::vector<TBytes> bad{
+		BenchMessage({{REG_Read1, {0x00}}, {REG_Read1, {0x41}}}),
+		BenchMessage({{REG_Write1, {0x01, 1, 2, 3, 4}}}),
+		BenchMessage({{REG_Read1, {0x00}}, {DAC_Output1, {7, 0, 0, 0, 0}}}),
+		BenchMessage({{REG_Read1, {0x00}}}, 'Q', true),
+	};
+	std::vector<const TBytes *> mix, malformed;
+	for (int i = 0; i < 100; i++)
+		mix.push_back(i % 10 == 9 ? &bad[(i / 10) % bad.size()] : &good[i % good.size()]);
+	for (auto &bytes : bad)
+		malformed.push_back(&bytes);
+
+	if (!freopen("/dev/null", "w", stdout))
+		return 1;
+	long mixErrors, malformedErrors;
+	double mixNs = BestOf([&] { return ParseNs(mix, mixErrors); });
+	double malformedNs = BestOf([&] { return ParseNs(malformed, malformedErrors); });
+	if (mixErrors != ROUNDS * 10 || malformedErrors != ROUNDS * (long)malformed.size())
+	{
+		fprintf(stderr, "expected every malformed Message, and only those, to fail to parse\n");
+		return 1;
+	}
+	fprintf(stderr, "10%% malformed mix: %.0f ns/Message; malformed only: %.0f ns/Message\n", mixNs, malformedNs);
+}
@@ -0,0 +1,65 @@
+/*
+	MpscQueue against the SafeQueue it replaced: P producer threads enqueue ITEMS pointers between them while one
+	consumer drains them, dequeueBatch() for MpscQueue and dequeue() for SafeQueue, as the ActionThread does.
+	Reports ns per item, the best of REPEATS runs, at 1, 4 and 32 producers (or the counts given as arguments).
+
+		make bench/mpsc_queue && bench/mpsc_queue [producers...]
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../mpsc_queue.h"
+#include "../safe_queue.h"
+
+#define ITEMS 2000000
+#define REPEATS 5
+#define QUEUE_DEPTH 4096 // ACTION_QUEUE_DEPTH
+#define BATCH 64		 // ACTION_BATCH_SIZE
+
+static char Items[1]; // every item is a pointer into this; the consumer only counts them
+
+template <class Queue, class Drain>
+static double run(int producers, Queue &q, Drain drain)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++)
+		threads.emplace_back([&q, p, producers] {
+			for (long i = p; i < ITEMS; i += producers)
+				q.enqueue(Items);
+		});
+	for (long received = 0; received < ITEMS;)
+		received += drain();
+	for (auto &t : threads)
+		t.join();
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ITEMS;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<int> counts = {1, 4, 32};
+	if (argc > 1)
+		counts.clear();
+	for (int i = 1; i < argc; i++)
+		counts.push_back(atoi(argv[i]));
+
+	printf("%u CPUs, %d items, ns/item (best of %d)\n", std::thread::hardware_concurrency(), ITEMS, REPEATS);
+	for (int producers : counts)
+	{
+		double safe = 1e9, mpsc = 1e9;
+		for (int r = 0; r < REPEATS; r++)
+		{
+			SafeQueue<char *> sq;
+			safe = std::min(safe, run(producers, sq, [&sq] { return sq.dequeue() ? 1 : 0; }));
+			MpscQueue<char *> mq(QUEUE_DEPTH);
+			char *batch[BATCH];
+			mpsc = std::min(mpsc, run(producers, mq, [&mq, &batch] { return (int)mq.dequeueBatch(batch, BATCH); }));
+		}
+		printf("%3d producers: SafeQueue %6.1f  MpscQueue %6.1f\n", producers, safe, mpsc);
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+	Parse throughput: TMessage::FromBytes() into a TMessageArena, as GotMessage() does it, for a 1-DataItem Message
+	and a 16-DataItem bundle, in ns per Message, Messages/s and MB/s of received bytes.
+
+	make bench/parse && bench/parse
+*/
+
+#include <cstdio>
+
+#include "bench.h"
+#include "../TMessage.h"
+#include "../message_arena.h"
+
+#define MESSAGES 200000
+
+static double ParseNs(const TBytes &bytes)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < MESSAGES; i++)
+	{
+		TMessageArena arena;
+		TError result;
+		TMessage *msg = arena.make<TMessage>(TMessage::FromBytes(TBytesView(bytes), result, &arena));
+		if (result != ERR_SUCCESS)
+		{
+			printf("FromBytes() failed: %d\n", result);
+			exit(1);
+		}
+		TMessageArena::destroy(msg);
+	}
+	return NsSince(start) / MESSAGES;
+}
+
+int main()
+{
+	struct
+	{
+		const char *name;
+		TBytes bytes;
+	} cases[] = {
+		{"1 x REG_Read1", BenchMessage(BenchRepeat(1, REG_Read1, {0x00}))},
+		{"16 x REG_Read1", BenchMessage(BenchRepeat(16, REG_Read1, {0x00}))},
+		{"16 x REG_Write1", BenchMessage(BenchRepeat(16, REG_Write1, {0x40, 1, 2, 3, 4}))},
+	};
+	for (auto &c : cases)
+	{
+		double ns = BestOf([&] { return ParseNs(c.bytes); });
+		printf("%-16s %4zu bytes  %7.1f ns/Message  %9.0f Messages/s  %7.1f MB/s\n", c.name, c.bytes.size(), ns,
+			   1e9 / ns, c.bytes.size() * 1e3 / ns);
+	}
+}
@@ -0,0 +1,246 @@
+/*
+	Parse throughput through the ParsePool, by worker count: the Control path from a framed Message to admission,
+	without the sockets.  IO_THREADS feeders stand in for the reactor's I/O threads, each framing Messages for its
+	share of CONNECTIONS connections; each Message goes through a copy of ControlReceived() (a fresh arena, the bytes
+	copied into it, trySubmit() to a WorkStealingPool keyed by connection, parsed inline if the pool is full or the
+	Message is under PARSE_POOL_MIN_BYTES), then
+	ParseReceived() (FromBytes() into the arena) and QueueParsed()'s per-connection reordering, ending where the
+	daemon would call AdmitAction().  0 workers parses on the feeders, as the daemon does on a 1-CPU host.
+
+	Reports Messages/s; the I/O threads' CPU time per Message (with 0 workers, the whole parse); and how many Messages finished parsing ahead of an earlier one on their connection and
+	had to wait in the reorder map.  Parsing scales only while there are free cores: compare the worker counts
+	against the 0-worker line, on a host with at least IO_THREADS + workers CPUs.  With fewer, the workers can't keep
+	up, the pool fills, and the I/O threads parse most Messages themselves anyway, so first it measures what handing
+	one Message to an idle pool costs an I/O thread: the pool can only help while that is below the I/O thread's cost
+	of parsing it (the 0-worker line), and then by at most their ratio.
+
+	make bench/parse_pool && bench/parse_pool [workers...]
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "bench.h"
+#include "../TMessage.h"
+#include "../message_arena.h"
+#include "../work_stealing_pool.h"
+
+#define IO_THREADS 2 // TReactor's default
+#define CONNECTIONS 8
+#define MESSAGES_PER_CONNECTION 50000
+#define PARSE_POOL_DEPTH 1024 // as in aioenetd.cpp
+#define PARSE_POOL_MIN_BYTES 64 // ditto
+
+// stands in for TActionQueueItem
+struct TBenchAction
+{
+	TMessage *theMessage;
+	TMessageArena *Arena;
+};
+
+// the parts of a TControlConnection that parsing touches
+struct TBenchConnection
+{
+	int Socket;
+	__u64 RxSequence = 0;
+	std::mutex ParsedLock;
+	__u64 NextToQueue = 0;
+	std::map<__u64, TBenchAction *> Parsed;
+	__u64 Admitted = 0, Parked = 0, OutOfOrder = 0;
+};
+
+struct TBenchJob
+{
+	TBenchConnection *Connection;
+	TMessageArena *Arena;
+	const char *Bytes;
+	ssize_t Length;
+	__u64 Sequence;
+};
+
+// where the daemon calls AdmitAction(); checks the order, and frees the Message as ReleaseAction() would
+static void Admit(TBenchConnection *conn, __u64 sequence, TBenchAction *Action)
+{
+	conn->OutOfOrder += sequence != conn->Admitted++;
+	if (Action)
+	{
+		TMessageArena *arena = Action->Arena;
+		TMessageArena::destroy(Action->theMessage);
+		TMessageArena::destroy(Action);
+		delete arena;
+	}
+}
+
+static void QueueParsed(TBenchConnection *conn, __u64 sequence, TBenchAction *Action)
+{
+	std::lock_guard<std::mutex> lock(conn->ParsedLock);
+	if (sequence != conn->NextToQueue)
+	{
+		conn->Parsed[sequence] = Action;
+		conn->Parked++;
+		return;
+	}
+	Admit(conn, sequence, Action);
+	conn->NextToQueue++;
+	for (auto next = conn->Parsed.begin(); (next != conn->Parsed.end()) && (next->first == conn->NextToQueue);
+		 next = conn->Parsed.erase(next))
+	{
+		Admit(conn, next->first, next->second);
+		conn->NextToQueue++;
+	}
+}
+
+static void ParseReceived(TBenchJob *job)
+{
+	TBenchConnection *conn = job->Connection;
+	__u64 sequence = job->Sequence;
+	TMessageArena *arena = job->Arena;
+	TError result;
+	TMessage *msg = arena->make<TMessage>(
+		TMessage::FromBytes(TBytesView((const __u8 *)job->Bytes, job->Length), result, arena));
+	TMessageArena::destroy(job);
+	TBenchAction *Action = nullptr;
+	if (result == ERR_SUCCESS)
+		Action = arena->make<TBenchAction>(TBenchAction{msg, arena});
+	else
+	{
+		TMessageArena::destroy(msg);
+		delete arena;
+	}
+	QueueParsed(conn, sequence, Action);
+}
+
+static WorkStealingPool<TBenchJob *> *Pool;
+
+static void ControlReceived(TBenchConnection *conn, const TBytes &bytes, size_t minPoolBytes = PARSE_POOL_MIN_BYTES)
+{
+	TMessageArena *arena = new TMessageArena;
+	TBenchJob *job = arena->make<TBenchJob>(
+		TBenchJob{conn, arena, (const char *)bytes.data(), (ssize_t)bytes.size(), conn->RxSequence++});
+	if (Pool->threadCount() && (bytes.size() >= minPoolBytes))
+	{
+		char *copy = (char *)arena->allocate(bytes.size(), 1);
+		memcpy(copy, bytes.data(), bytes.size());
+		job->Bytes = copy;
+		if (Pool->trySubmit(job, conn->Socket))
+			return;
+		job->Bytes = (const char *)bytes.data();
+	}
+	ParseReceived(job);
+}
+
+static double ThreadCpuNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Messages/s through workers ParseWorkers; adds to parked the Messages that waited to be admitted in order, and to
+// ioNs the CPU time the feeders spent per Message
+static double MessagesPerSecond(const TBytes &bytes, int workers, double &parked, double &ioNs)
+{
+	TBenchConnection conns[CONNECTIONS];
+	for (int i = 0; i < CONNECTIONS; i++)
+		conns[i].Socket = i;
+	WorkStealingPool<TBenchJob *> pool(&ParseReceived, PARSE_POOL_DEPTH);
+	Pool = &pool;
+	pool.Start(workers);
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread feeders[IO_THREADS];
+	double feederNs[IO_THREADS];
+	for (int t = 0; t < IO_THREADS; t++)
+		feeders[t] = std::thread([&, t] {
+			double cpu = ThreadCpuNs();
+			for (int n = 0; n < MESSAGES_PER_CONNECTION; n++)
+				for (int i = t; i < CONNECTIONS; i += IO_THREADS)
+					ControlReceived(&conns[i], bytes);
+			feederNs[t] = ThreadCpuNs() - cpu;
+		});
+	for (int t = 0; t < IO_THREADS; t++)
+	{
+		feeders[t].join();
+		ioNs += feederNs[t] / (CONNECTIONS * MESSAGES_PER_CONNECTION);
+	}
+	pool.Stop(); // runs what's still queued
+	double seconds = NsSince(start) / 1e9;
+
+	for (auto &conn : conns)
+	{
+		if (conn.Admitted != MESSAGES_PER_CONNECTION || conn.OutOfOrder || !conn.Parsed.empty())
+		{
+			printf("connection %d: %llu admitted, %llu out of order\n", conn.Socket, (unsigned long long)conn.Admitted,
+				   (unsigned long long)conn.OutOfOrder);
+			exit(1);
+		}
+		parked += conn.Parked;
+	}
+	return CONNECTIONS * MESSAGES_PER_CONNECTION / seconds;
+}
+
+// I/O thread CPU time per Message handed to an idle pool: the arena, the copy and trySubmit(), waking a worker.
+// Submits in bursts the pool has room for, and lets the workers catch up between them, so nothing is parsed inline;
+// PARSE_POOL_MIN_BYTES is set from this
+static double HandoffNs(const TBytes &bytes)
+{
+	const int bursts = 200, burst = PARSE_POOL_DEPTH / 2;
+	TBenchConnection conn;
+	conn.Socket = 0;
+	WorkStealingPool<TBenchJob *> pool(&ParseReceived, PARSE_POOL_DEPTH);
+	Pool = &pool;
+	pool.Start(1);
+	double ns = 0;
+	for (int b = 0; b < bursts; b++)
+	{
+		double cpu = ThreadCpuNs();
+		for (int i = 0; i < burst; i++)
+			ControlReceived(&conn, bytes, 0);
+		ns += ThreadCpuNs() - cpu;
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> lock(conn.ParsedLock);
+				if (conn.Admitted == conn.RxSequence)
+					break;
+			}
+			std::this_thread::yield();
+		}
+	}
+	pool.Stop();
+	return ns / (bursts * burst);
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<int> workers;
+	for (int i = 1; i < argc; i++)
+		workers.push_back(atoi(argv[i]));
+	if (workers.empty())
+		workers = {0, 1, 2, 4, 8};
+	struct
+	{
+		const char *name;
+		TBytes bytes;
+	} cases[] = {
+		{"1 x REG_Read1", BenchMessage(BenchRepeat(1, REG_Read1, {0x00}))},
+		{"8 x REG_Read1", BenchMessage(BenchRepeat(8, REG_Read1, {0x00}))},
+		{"16 x REG_Read1", BenchMessage(BenchRepeat(16, REG_Read1, {0x00}))},
+	};
+	printf("%u CPUs, %d I/O threads, %d connections\n", std::thread::hardware_concurrency(), IO_THREADS, CONNECTIONS);
+	for (auto &c : cases)
+		printf("%-16s %3zu bytes: handing it to the pool costs the I/O thread %.0f ns\n", c.name, c.bytes.size(),
+			   BestOf([&] { return HandoffNs(c.bytes); }));
+	for (auto &c : cases)
+		for (int n : workers)
+		{
+			double parked = 0, ioNs = 0, best = 0;
+			for (int i = 0; i < REPEATS; i++)
+				best = std::max(best, MessagesPerSecond(c.bytes, n, parked, ioNs));
+			printf("%-16s %d workers  %9.0f Messages/s  I/O thread %5.0f ns/Message  %5.1f%% parked for order\n",
+				   c.name, n, best, ioNs / REPEATS, 100 * parked / (REPEATS * CONNECTIONS * MESSAGES_PER_CONNECTION));
+		}
+}
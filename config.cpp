@@ -17,6 +17,7 @@ void initConfigStruct(TConfig &config) {
 	config.FpgaVersionCode = 0xDEADBA57;
 	config.numberOfSubmuxes = 0;
 	config.adcDifferential = 0b00000000;
+	config.clientWeights = "";
 	for (int i = 0; i < 16; i++) {
 		if (i < 4) {
 			config.submuxBarcodes[i]="";
@@ -65,8 +66,10 @@ int ReadConfigString(std::string key, std::string &value, std::string which )
 		perror("ReadConfigString() failed ");
 		return result;
 	}
+	close(f);
+	buf[result] = 0;
 	int L = strlen((char *) buf)-1;
-	if(buf[L] = 0x10)
+	if ((L >= 0) && (buf[L] == '\n'))
 		buf[L] = 0;
 
 	value = std::string((char *)buf);
@@ -262,4 +265,6 @@ void LoadConfig(std::string which)
 	HandleError(ReadConfigFloat("DAC_OffsetCh1", Config.dacOffsetCoefficients[1], which));
 	HandleError(ReadConfigFloat("DAC_OffsetCh2", Config.dacOffsetCoefficients[2], which));
 	HandleError(ReadConfigFloat("DAC_OffsetCh3", Config.dacOffsetCoefficients[3], which));
+
+	HandleError(ReadConfigString("TCP_ClientWeights", Config.clientWeights, which));
 }
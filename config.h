@@ -55,6 +55,7 @@ typedef struct TConfigStruct {
 	__u32 dacRanges[4];
 	float dacScaleCoefficients[4];
 	float dacOffsetCoefficients[4];
+	std::string clientWeights; // action-thread scheduling weights by Client IP: "192.168.1.20=8,fe80::1=2"; others get 1
 } TConfig;
 extern TConfig Config;
 
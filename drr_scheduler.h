@@ -0,0 +1,121 @@
+#pragma once
+/*
+	Deficit round robin (M. Shreedhar and G. Varghese) over per-flow FIFOs, for a single thread.
+
+	Each flow with work queued takes turns; a turn grants it quantum * weight credit, and the flow is served while
+	its oldest item costs no more than the credit it has left.  An item is never split: one that costs more than a
+	turn's credit waits, banking credit, for as many turns as it takes.  So over time every busy flow gets service
+	in proportion to its weight however big or small its items are, and a flow that goes from idle to busy waits
+	at most one turn of each other busy flow.
+
+	A flow exists only while it has items queued: an idle flow keeps no credit, and costs nothing.
+*/
+
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+template <class T, class Key>
+class DrrScheduler
+{
+public:
+	DrrScheduler(size_t quantum) : quantum(quantum) {}
+
+	bool empty() { return active.empty(); }
+
+	// items queued across every flow
+	size_t size() { return count; }
+
+	// queues item on key's flow; weight (at least 1) applies from the flow's next turn
+	void push(Key key, T item, size_t cost, int weight = 1)
+	{
+		auto found = flows.find(key);
+		if (found == flows.end())
+		{
+			active.push_back(Flow{key, {}, 0, 1, false});
+			found = flows.emplace(key, std::prev(active.end())).first;
+		}
+		Flow &flow = *found->second;
+		flow.weight = (weight > 0) ? weight : 1;
+		flow.items.push_back({item, cost});
+		count++;
+	}
+
+	// the next item in DRR order; only when !empty()
+	T pop()
+	{
+		T item;
+		pop(item, [](const T &) { return true; });
+		return item;
+	}
+
+	/*
+		The next item in DRR order among flows whose oldest item eligible(item) accepts; false if there is none.
+
+		A flow that can't go keeps its place in line, and its credit, so it is first to go once it can: a flow waiting
+		on something other flows keep taking isn't overtaken turn after turn.  eligible() may be asked about the same
+		item more than once.
+	*/
+	template <class Eligible>
+	bool pop(T &item, Eligible eligible)
+	{
+		for (auto it = active.begin(); it != active.end();)
+		{
+			Flow &flow = *it;
+			if (!eligible(flow.items.front().item))
+			{
+				++it;
+				continue;
+			}
+			if (!flow.bTurn)
+			{
+				flow.deficit += quantum * flow.weight;
+				flow.bTurn = true;
+			}
+			if (flow.items.front().cost <= flow.deficit)
+			{
+				item = flow.items.front().item;
+				flow.deficit -= flow.items.front().cost;
+				flow.items.pop_front();
+				count--;
+				if (flow.items.empty())
+				{
+					flows.erase(flow.key);
+					active.erase(it);
+				}
+				return true;
+			}
+			// turn over: to the back of the line, keeping the credit it didn't spend; if it was the last in line it
+			// is also the next
+			flow.bTurn = false;
+			auto next = std::next(it);
+			active.splice(active.end(), active, it);
+			if (next == active.end())
+				next = std::prev(active.end());
+			it = next;
+		}
+		return false;
+	}
+
+private:
+	struct Entry
+	{
+		T item;
+		size_t cost;
+	};
+	struct Flow
+	{
+		Key key;
+		std::deque<Entry> items;
+		size_t deficit = 0;
+		int weight = 1;
+		bool bTurn = false; // has had this turn's credit
+	};
+
+	size_t quantum;
+	size_t count = 0;
+	std::list<Flow> active; // flows with items queued, in turn order; front() is the one being served
+	std::unordered_map<Key, typename std::list<Flow>::iterator> flows;
+};
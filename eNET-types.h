@@ -25,6 +25,8 @@ typedef uint32_t __u32;
 #include <string>
 #include <iomanip>
 #include <memory>
+#include <memory_resource>
+#include <span>
 #include <vector>
 #include <thread>
 
@@ -33,6 +35,8 @@ typedef uint32_t __u32;
 
 /* type definitions */
 typedef std::vector<__u8> TBytes;
+// non-owning view of received bytes; the parser works on these so it never copies the receive buffer
+typedef std::span<const __u8> TBytesView;
 typedef __u8 TMessageId;
 typedef __u32 TMessagePayloadSize;
 typedef __u8 TCheckSum;
@@ -42,7 +46,6 @@ typedef __u16 TDataItemLength;
 class TDataItem;
 
 typedef std::shared_ptr<TDataItem> PTDataItem;
-typedef std::vector<PTDataItem> TPayload;
 
 // convert integer to hex, no '0x' prefixed
 template <typename T>
@@ -0,0 +1,24 @@
+#pragma once
+/*
+	Minimal futex wrappers used by the lock-free queues to sleep only when there is nothing to do.
+	The futex word is a std::atomic<int>; on Linux std::atomic<int> is lock-free and layout-compatible with int.
+*/
+
+#include <atomic>
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// sleeps while *word == expected; returns early on futexWake(), a signal, or timeout (if not null)
+inline int futexWait(std::atomic<int> &word, int expected, const struct timespec *timeout = nullptr)
+{
+	return syscall(SYS_futex, (int *)&word, FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+// wakes up to count waiters sleeping on word
+inline int futexWake(std::atomic<int> &word, int count = INT_MAX)
+{
+	return syscall(SYS_futex, (int *)&word, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
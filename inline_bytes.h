@@ -0,0 +1,137 @@
+#pragma once
+/*
+	A byte vector that keeps up to N bytes inside itself and only goes to the heap beyond that.
+
+	A DataItem's Data is almost always a handful of bytes (a register offset, an offset and a value, a channel and a
+	range code), so holding it in a std::vector cost a heap allocation per DataItem for a few bytes.  TInlineBytes
+	has the parts of the std::vector interface the DataItems use -- size(), data(), [], iteration, push_back() -- and
+	converts to TBytesView like a vector does.  Once it spills (e.g., CFG_Hostname, REG_ReadBuf results) it behaves
+	like a vector: capacity doubles, and shrinking never moves the bytes back inline.
+*/
+
+#include <cstddef>
+#include <cstring>
+
+#include "eNET-types.h"
+
+template <size_t N>
+class TInlineBytes
+{
+public:
+	TInlineBytes() = default;
+	TInlineBytes(TBytesView bytes) { assign(bytes); }
+	TInlineBytes(const TBytes &bytes) { assign(bytes); }
+	TInlineBytes(const TInlineBytes &other) { assign(other); }
+	TInlineBytes(TInlineBytes &&other) noexcept { take(other); }
+	~TInlineBytes() { release(); }
+
+	TInlineBytes &operator=(const TInlineBytes &other)
+	{
+		if (this != &other)
+			assign(other);
+		return *this;
+	}
+
+	TInlineBytes &operator=(TInlineBytes &&other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			take(other);
+		}
+		return *this;
+	}
+
+	TInlineBytes &operator=(TBytesView bytes)
+	{
+		assign(bytes);
+		return *this;
+	}
+
+	TInlineBytes &operator=(const TBytes &bytes)
+	{
+		assign(bytes);
+		return *this;
+	}
+
+	// replaces the contents with a copy of bytes, which may not point into this
+	void assign(TBytesView bytes)
+	{
+		length = 0;
+		reserve(bytes.size());
+		if (bytes.size())
+			memcpy(buf, bytes.data(), bytes.size());
+		length = bytes.size();
+	}
+
+	void push_back(__u8 byte)
+	{
+		if (length == cap)
+			reserve(cap * 2);
+		buf[length++] = byte;
+	}
+
+	void clear() { length = 0; }
+
+	// makes room for at least n bytes, keeping the current ones
+	void reserve(size_t n)
+	{
+		if (n <= cap)
+			return;
+		__u8 *grown = new __u8[n];
+		if (length)
+			memcpy(grown, buf, length);
+		release();
+		buf = grown;
+		cap = n;
+	}
+
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+	size_t capacity() const { return cap; }
+	// still using the inline storage
+	bool isInline() const { return buf == inlineBuf; }
+
+	__u8 *data() { return buf; }
+	const __u8 *data() const { return buf; }
+	__u8 *begin() { return buf; }
+	__u8 *end() { return buf + length; }
+	const __u8 *begin() const { return buf; }
+	const __u8 *end() const { return buf + length; }
+	__u8 &operator[](size_t i) { return buf[i]; }
+	const __u8 &operator[](size_t i) const { return buf[i]; }
+
+private:
+	void release()
+	{
+		if (buf != inlineBuf)
+			delete[] buf;
+		buf = inlineBuf;
+		cap = N;
+	}
+
+	// steals other's heap block, or copies its inline bytes; leaves other empty
+	void take(TInlineBytes &other)
+	{
+		if (other.buf == other.inlineBuf)
+		{
+			memcpy(inlineBuf, other.inlineBuf, other.length);
+			buf = inlineBuf;
+			cap = N;
+		}
+		else
+		{
+			buf = other.buf;
+			cap = other.cap;
+			other.buf = other.inlineBuf;
+			other.cap = N;
+		}
+		length = other.length;
+		other.length = 0;
+	}
+
+	__u8 *buf = inlineBuf;
+	size_t length = 0;
+	size_t cap = N;
+	__u8 inlineBuf[N];
+};
@@ -31,7 +31,7 @@ int Log(const std::string message, const source_location &loc)
 	return 0;
 }
 
-int Log(const std::string intro, const TBytes bytes, bool crlf, const source_location &loc)
+int Log(const std::string intro, const TBytesView bytes, bool crlf, const source_location &loc)
 {
 	std::stringstream msg;
 	msg << intro;
@@ -49,7 +49,7 @@ int Trace(const std::string message, const source_location &loc)
 	return 0;
 }
 
-int Trace(const std::string intro, const TBytes bytes, bool crlf, const source_location &loc)
+int Trace(const std::string intro, const TBytesView bytes, bool crlf, const source_location &loc)
 {
 	std::stringstream msg;
 	msg << intro;
@@ -67,7 +67,7 @@ int Debug(const std::string message, const source_location &loc)
 	return 0;
 }
 
-int Debug(const std::string intro, const TBytes bytes, bool crlf, const source_location &loc)
+int Debug(const std::string intro, const TBytesView bytes, bool crlf, const source_location &loc)
 {
 	std::stringstream msg;
 	msg << intro;
@@ -84,7 +84,7 @@ int Error(const std::string message, const source_location &loc)
 	return 0;
 }
 
-int Error(const std::string intro, const TBytes bytes, bool crlf, const source_location &loc)
+int Error(const std::string intro, const TBytesView bytes, bool crlf, const source_location &loc)
 {
 	std::stringstream msg;
 	msg << intro;
@@ -22,7 +22,7 @@ using namespace std::experimental;
 #define Trace(...) {}
 #else
 int Trace(std::string message, const source_location &loc = source_location::current());
-int Trace(std::string intro, TBytes bytes, bool crlf = true, const source_location &loc = source_location::current());
+int Trace(std::string intro, TBytesView bytes, bool crlf = true, const source_location &loc = source_location::current());
 #endif
 
 #ifdef LOG_DISABLE_WARNING
@@ -33,15 +33,15 @@ int Trace(std::string intro, TBytes bytes, bool crlf = true, const source_locati
 #define Log(...) {}
 #else
 int Log(  std::string message, const source_location &loc = source_location::current());
-int Log(  std::string intro, TBytes bytes, bool crlf = true, const source_location &loc = source_location::current());
+int Log(  std::string intro, TBytesView bytes, bool crlf = true, const source_location &loc = source_location::current());
 #endif
 
 #ifdef LOG_DISABLE_DEBUG
 #define Debug(...) {}
 #else
 int Debug(std::string message, const source_location &loc = source_location::current());
-int Debug(std::string intro, TBytes bytes, bool crlf = true, const source_location &loc = source_location::current());
+int Debug(std::string intro, TBytesView bytes, bool crlf = true, const source_location &loc = source_location::current());
 #endif
 
 int Error(std::string message, const source_location &loc = source_location::current());
-int Error(std::string intro, TBytes bytes, bool crlf = true, const source_location &loc = source_location::current());
+int Error(std::string intro, TBytesView bytes, bool crlf = true, const source_location &loc = source_location::current());
@@ -0,0 +1,47 @@
+#pragma once
+/*
+	Memory for one received Message and everything hanging off it: the TMessage, its Payload vector (which holds most
+	DataItems by value; see TPayload.h), any other DataItem (object and shared_ptr control block in one piece), and
+	the TActionQueueItem that carries it to the ActionThread.
+
+	Allocation bumps a pointer through a buffer inside the arena itself, so parsing a typical bundle takes no heap
+	allocation beyond the arena's own, and receive threads don't contend on the allocator; deallocation is a no-op.
+	A bundle too big for the buffer spills into heap blocks the arena also owns.  Everything is freed in one step
+	when the arena is deleted, after the Message's Response is sent.
+
+	An arena belongs to one Message at a time and is not thread-safe: it is filled by the thread that parsed the
+	Message (a ParseWorker, which also keeps its copy of the received bytes here, or the I/O thread), and only read
+	after that.  Objects built with make() must be destroy()ed before the arena is
+	deleted, so their destructors run (and release the DataItems inside the arena).
+*/
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+#include "eNET-types.h"
+
+#define MESSAGE_ARENA_INLINE 4096 // bytes; a 16-DataItem bundle of REG_ DataItems needs under half of it
+
+class TMessageArena : public std::pmr::monotonic_buffer_resource
+{
+public:
+	TMessageArena() : monotonic_buffer_resource(inlineBuffer, sizeof(inlineBuffer)) {}
+	TMessageArena(const TMessageArena &) = delete;
+	TMessageArena &operator=(const TMessageArena &) = delete;
+
+	// constructs a T in the arena
+	template <class T, class... Args>
+	T *make(Args &&...args)
+	{
+		return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	// runs the destructor of something make() built; its memory goes back with the arena
+	template <class T>
+	static void destroy(T *object) { object->~T(); }
+
+private:
+	alignas(std::max_align_t) __u8 inlineBuffer[MESSAGE_ARENA_INLINE];
+};
@@ -0,0 +1,184 @@
+#pragma once
+/*
+	Bounded, lock-free, multi-producer/single-consumer queue.
+
+	Producers (the Control reactor's I/O threads) claim a cell with one CAS on enqueuePos and publish it with a
+	release store of the cell's sequence number (D. Vyukov's bounded queue); there is no mutex, and no syscall
+	unless the consumer is asleep.  The single consumer (the ActionThread) drains every published cell in one
+	dequeueBatch() call and only sleeps, on a futex, when the queue is empty.
+
+	An empty queue is first re-checked MPSC_SPIN_YIELDS times, yielding in between, before the consumer sleeps.
+	Sleeping the moment the queue drains made every enqueue behind it pay for a futex wake and a context switch, so
+	with a few busy producers the consumer took its Messages one or two per wakeup, and lost to SafeQueue (see
+	bench/mpsc_queue.cpp); a yield lets the producers fill a batch instead, and costs an idle consumer next to nothing.
+
+	T should be a pointer type: dequeue() returns nullptr after Stop(), like SafeQueue.
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "futex.h"
+
+#define MPSC_SPIN_YIELDS 16
+
+template <class T>
+class MpscQueue
+{
+public:
+	// capacity is rounded up to a power of two
+	MpscQueue(size_t capacity = 1024)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		mask = size - 1;
+		cells = std::vector<Cell>(size);
+		for (size_t i = 0; i < size; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// Add an element to the queue; returns false, without blocking, if the queue is full.
+	bool tryEnqueue(T t)
+	{
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		Cell *cell;
+		for (;;)
+		{
+			cell = &cells[pos & mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+			if (dif == 0)
+			{
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0)
+				return false; // full
+			else
+				pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+		cell->value = t;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+
+		// pairs with the fence in waitNotEmpty(): either the consumer sees our cell or we see it sleeping
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping.load(std::memory_order_relaxed))
+		{
+			sleeping.store(0, std::memory_order_relaxed);
+			futexWake(sleeping, 1);
+		}
+		return true;
+	}
+
+	// Add an element to the queue, yielding while it is full.
+	void enqueue(T t)
+	{
+		while (!tryEnqueue(t))
+		{
+			if (stop)
+				return;
+			std::this_thread::yield();
+		}
+	}
+
+	// Get the "front"-element.
+	// If the queue is empty, wait till a element is available.
+	T dequeue(void)
+	{
+		T val = nullptr;
+		dequeueBatch(&val, 1);
+		return val;
+	}
+
+	// Moves up to max published elements into out[], waiting while the queue is empty.
+	// Returns the number moved; 0 only after Stop().
+	size_t dequeueBatch(T *out, size_t max)
+	{
+		for (int spins = 0;; spins++)
+		{
+			size_t count = tryDequeueBatch(out, max);
+			if (count || stop)
+				return count;
+			if (spins < MPSC_SPIN_YIELDS)
+				std::this_thread::yield();
+			else
+			{
+				waitNotEmpty();
+				spins = 0;
+			}
+		}
+	}
+
+	// Moves up to max published elements into out[] without waiting.
+	size_t tryDequeueBatch(T *out, size_t max)
+	{
+		size_t count = 0;
+		while (count < max)
+		{
+			Cell *cell = &cells[dequeuePos & mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			if ((intptr_t)seq - (intptr_t)(dequeuePos + 1) < 0)
+				break; // empty, or the next producer hasn't published yet
+			out[count++] = cell->value;
+			cell->sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+			dequeuePos++;
+		}
+		return count;
+	}
+
+	T tryDequeue(void)
+	{
+		T val = nullptr;
+		tryDequeueBatch(&val, 1);
+		return val;
+	}
+
+	// approximate; exact only when called by the consumer with producers idle
+	size_t size()
+	{
+		return enqueuePos.load(std::memory_order_relaxed) - dequeuePos;
+	}
+
+	size_t capacity()
+	{
+		return mask + 1;
+	}
+
+	void Stop(void)
+	{
+		stop = true;
+		sleeping.store(0);
+		futexWake(sleeping);
+	}
+
+private:
+	void waitNotEmpty()
+	{
+		sleeping.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		Cell *cell = &cells[dequeuePos & mask];
+		if (((intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)(dequeuePos + 1) >= 0) || stop)
+		{
+			sleeping.store(0, std::memory_order_relaxed);
+			return;
+		}
+		futexWait(sleeping, 1);
+	}
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::vector<Cell> cells;
+	size_t mask;
+	alignas(64) std::atomic<size_t> enqueuePos{0};
+	alignas(64) size_t dequeuePos = 0; // consumer-only
+	std::atomic<int> sleeping{0};
+	volatile bool stop = false;
+};
@@ -0,0 +1,381 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "TMessage.h"
+#include "reactor.h"
+
+// epoll_event.data.u64 carries the Control socket fd, plus this flag for events on its TxFd
+#define TX_EVENT (1ull << 32)
+#define WAKE_EVENT (~0ull)
+
+TReactor::TReactor(TReceiveHandler OnReceive, int threadCount) : OnReceive(OnReceive), threadCount(threadCount)
+{
+}
+
+TReactor::~TReactor()
+{
+	Stop();
+}
+
+int TReactor::Start()
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+	{
+		Error("epoll_create1() failed, errno: " + std::to_string(errno));
+		return -errno;
+	}
+
+	// the wake eventfd is level-triggered and never read, so once written every I/O thread sees it and exits
+	wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	struct epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.u64 = WAKE_EVENT;
+	if ((wakefd < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0))
+	{
+		Error("reactor wake eventfd setup failed, errno: " + std::to_string(errno));
+		return -errno;
+	}
+
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_t io_thread;
+		if (0 == pthread_create(&io_thread, NULL, &TReactor::IoThread, this))
+			threads.push_back(io_thread);
+	}
+	Log("Control reactor started with " + std::to_string(threads.size()) + " I/O threads");
+	return threads.size() ? 0 : -1;
+}
+
+void TReactor::Stop()
+{
+	if (epfd < 0)
+		return;
+	bStop = true;
+	__u64 one = 1;
+	if (write(wakefd, &one, sizeof(one)) < 0)
+		Error("reactor wake failed, errno: " + std::to_string(errno));
+	for (auto io_thread : threads)
+		pthread_join(io_thread, NULL);
+	threads.clear();
+
+	std::lock_guard<std::mutex> lock(m);
+	for (auto &entry : Connections)
+	{
+		PTControlConnection conn = entry.second;
+		std::lock_guard<std::mutex> txLock(conn->TxLock);
+		conn->Close();
+		close(conn->TxFd);
+		close(conn->Socket);
+	}
+	Connections.clear();
+	close(wakefd);
+	close(epfd);
+	wakefd = epfd = -1;
+}
+
+int TReactor::Add(int Socket, int Weight)
+{
+	int flags = fcntl(Socket, F_GETFL, 0);
+	if ((flags < 0) || (fcntl(Socket, F_SETFL, flags | O_NONBLOCK) < 0))
+	{
+		Error("failed to make Control socket " + std::to_string(Socket) + " non-blocking, errno: " + std::to_string(errno));
+		return -errno;
+	}
+
+	int TxFd = dup(Socket);
+	if (TxFd < 0)
+	{
+		Error("failed to dup() Control socket " + std::to_string(Socket) + ", errno: " + std::to_string(errno));
+		return -errno;
+	}
+
+	PTControlConnection conn = std::make_shared<TControlConnection>(Socket, TxFd);
+	conn->Weight = Weight;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		Connections[Socket] = conn;
+	}
+
+	struct epoll_event ev{};
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+	ev.data.u64 = Socket;
+	struct epoll_event txev{};
+	txev.events = EPOLLOUT | EPOLLET;
+	txev.data.u64 = Socket | TX_EVENT;
+	if ((epoll_ctl(epfd, EPOLL_CTL_ADD, TxFd, &txev) < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, Socket, &ev) < 0))
+	{
+		int err = errno;
+		Error("epoll_ctl(ADD) failed for Control socket " + std::to_string(Socket) + ", errno: " + std::to_string(err));
+		epoll_ctl(epfd, EPOLL_CTL_DEL, TxFd, NULL);
+		close(TxFd);
+		std::lock_guard<std::mutex> lock(m);
+		Connections.erase(Socket);
+		return -err;
+	}
+	Log("Control connection " + std::to_string(Socket) + " registered with reactor");
+	return 0;
+}
+
+size_t TReactor::Count()
+{
+	std::lock_guard<std::mutex> lock(m);
+	return Connections.size();
+}
+
+void *TReactor::IoThread(void *arg)
+{
+	((TReactor *)arg)->Run();
+	return nullptr;
+}
+
+void TReactor::Run()
+{
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	Trace("Control I/O thread started");
+	while (!bStop)
+	{
+		int n = epoll_wait(epfd, events, REACTOR_MAX_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Error("epoll_wait() failed, errno: " + std::to_string(errno));
+			break;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.u64 == WAKE_EVENT)
+				continue;
+			int Socket = events[i].data.u64 & 0xFFFFFFFF;
+
+			// hold a reference so a concurrent Stop() can't free the connection out from under us
+			PTControlConnection conn;
+			{
+				std::lock_guard<std::mutex> lock(m);
+				auto found = Connections.find(Socket);
+				if (found == Connections.end())
+					continue;
+				conn = found->second;
+			}
+
+			if (events[i].data.u64 & TX_EVENT)
+			{
+				Writable(conn);
+				continue;
+			}
+
+			if (!Readable(conn) || (Rearm(conn) < 0))
+				Disconnect(conn);
+		}
+	}
+	Trace("Control I/O thread exiting");
+}
+
+bool TReactor::Readable(PTControlConnection conn)
+{
+	int bufLen = maxPayloadLength + minimumMessageLength + 1;
+	static thread_local std::vector<char> buffer(bufLen);
+	for (;;)
+	{
+		ssize_t bytesRead = recv(conn->Socket, buffer.data(), bufLen, MSG_NOSIGNAL);
+		if (bytesRead < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return true; // drained; edge-triggered so we must stop only here
+			if (errno == EINTR)
+				continue;
+			Error("error on Control recv(): " + std::to_string(errno));
+			return false;
+		}
+		if (bytesRead == 0)
+			return false;
+
+		if (!Deframe(conn, buffer.data(), bytesRead))
+			return false;
+	}
+}
+
+// returns the total length of the Message starting at buf, 0 if more bytes are needed to know, or -1 if unframeable
+static ssize_t FramedLength(const __u8 *buf, size_t len)
+{
+	if (len < sizeof(TMessageHeader))
+		return 0;
+	TMessagePayloadSize payload_size = PAYLOAD_SIZE(((TMessageHeader *)buf)->payload_size);
+	if (payload_size > maxPayloadLength)
+		return -1;
+	return minimumMessageLength + payload_size;
+}
+
+bool TReactor::Deframe(PTControlConnection conn, char buffer[], ssize_t bytesRead)
+{
+	const __u8 *bytes = (const __u8 *)buffer;
+	size_t len = bytesRead;
+
+	// only stage through RxBuffer when a partial Message is already pending; otherwise frame straight out of buffer[]
+	if (!conn->RxBuffer.empty())
+	{
+		conn->RxBuffer.insert(conn->RxBuffer.end(), bytes, bytes + len);
+		bytes = conn->RxBuffer.data();
+		len = conn->RxBuffer.size();
+	}
+
+	size_t consumed = 0;
+	for (;;)
+	{
+		ssize_t msgLen = FramedLength(bytes + consumed, len - consumed);
+		if (msgLen < 0)
+		{
+			Error("Control connection " + std::to_string(conn->Socket) + " sent a Message header with payload_size > maxPayloadLength; cannot re-synchronize");
+			conn->RxBuffer.clear();
+			return false;
+		}
+		if ((msgLen == 0) || ((size_t)msgLen > len - consumed))
+			break;
+		OnReceive(conn, (char *)bytes + consumed, msgLen);
+		consumed += msgLen;
+	}
+
+	if (conn->RxBuffer.empty())
+		conn->RxBuffer.assign(bytes + consumed, bytes + len);
+	else
+		conn->RxBuffer.erase(conn->RxBuffer.begin(), conn->RxBuffer.begin() + consumed);
+	return true;
+}
+
+int TReactor::Rearm(PTControlConnection conn)
+{
+	struct epoll_event ev{};
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+	ev.data.u64 = conn->Socket;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->Socket, &ev) < 0)
+	{
+		Error("epoll_ctl(MOD) failed for Control socket " + std::to_string(conn->Socket) + ", errno: " + std::to_string(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+void TReactor::Disconnect(PTControlConnection conn)
+{
+	struct sockaddr_in addr;
+	socklen_t addrSize = sizeof(addr);
+	getpeername(conn->Socket, (struct sockaddr *)&addr, &addrSize);
+	Log(std::string("Host disconnected Control connection " + std::to_string(conn->Socket) + ", ip: ") + inet_ntoa(addr.sin_addr) + ", listen_port " + std::to_string(ntohs(addr.sin_port)));
+	Log("Control connection " + std::to_string(conn->Socket) + ": at most " + std::to_string(conn->PeakInFlight) +
+		" Messages in flight, " + std::to_string(conn->Rejected) + " rejected");
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->Socket, NULL);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->TxFd, NULL);
+	{
+		std::lock_guard<std::mutex> lock(m);
+		Connections.erase(conn->Socket);
+	}
+	std::lock_guard<std::mutex> lock(conn->TxLock);
+	conn->Close();
+	close(conn->TxFd);
+	close(conn->Socket);
+}
+
+void TReactor::Writable(PTControlConnection conn)
+{
+	// the receive side owns teardown.  Disconnect() closes Socket under TxLock once bClosed is set, so while we hold
+	// it and the connection isn't closed, Socket is still ours and not a descriptor reused by a newer connection
+	std::lock_guard<std::mutex> lock(conn->TxLock);
+	if (conn->bClosed)
+		return;
+	if (conn->Flush() < 0)
+		shutdown(conn->Socket, SHUT_RDWR);
+}
+
+#pragma region TControlConnection implementation
+TBytes TControlConnection::AcquireBuffer(size_t size)
+{
+	TBytes bytes;
+	{
+		std::lock_guard<std::mutex> lock(TxLock);
+		if (!TxPool.empty())
+		{
+			bytes = std::move(TxPool.back());
+			TxPool.pop_back();
+		}
+	}
+	bytes.resize(size); // no allocation once a pooled buffer has grown to the usual reply size
+	return bytes;
+}
+
+int TControlConnection::Send(TBytes bytes)
+{
+	std::lock_guard<std::mutex> lock(TxLock);
+	if (bClosed)
+		return -ENOTCONN;
+	if (TxQueued + bytes.size() > REACTOR_TX_LIMIT)
+	{
+		Error("Control connection " + std::to_string(Socket) + " stalled with " + std::to_string(TxQueued) + " reply bytes queued; dropping it");
+		shutdown(Socket, SHUT_RDWR);
+		Close();
+		return -ENOBUFS;
+	}
+	TxQueued += bytes.size();
+	TxQueue.push_back(std::move(bytes));
+	if (TxQueue.size() > 1)
+		return 0; // already waiting on EPOLLOUT; the I/O thread will flush in order
+	return Flush();
+}
+
+int TControlConnection::Flush()
+{
+	while (!TxQueue.empty())
+	{
+		struct iovec iov[REACTOR_MAX_IOV];
+		int iovcnt = 0;
+		for (auto it = TxQueue.begin(); (it != TxQueue.end()) && (iovcnt < REACTOR_MAX_IOV); ++it, ++iovcnt)
+		{
+			size_t skip = (iovcnt == 0) ? TxOffset : 0;
+			iov[iovcnt].iov_base = it->data() + skip;
+			iov[iovcnt].iov_len = it->size() - skip;
+		}
+
+		struct msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		ssize_t sent = sendmsg(Socket, &msg, MSG_NOSIGNAL); // a Client that resets the connection mustn't SIGPIPE us
+		if (sent < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return 0; // EPOLLOUT on TxFd will bring us back
+			if (errno == EINTR)
+				continue;
+			Error("! TCP Send of Reply to Control " + std::to_string(Socket) + " failed, errno: " + std::to_string(errno));
+			Close();
+			return -errno;
+		}
+		Trace("sent " + std::to_string(sent) + " bytes to Control Client# " + std::to_string(Socket));
+
+		TxQueued -= sent;
+		sent += TxOffset;
+		while (!TxQueue.empty() && ((size_t)sent >= TxQueue.front().size()))
+		{
+			sent -= TxQueue.front().size();
+			if (TxPool.size() < REACTOR_TX_POOL)
+				TxPool.push_back(std::move(TxQueue.front()));
+			TxQueue.pop_front();
+		}
+		TxOffset = sent;
+	}
+	return 0;
+}
+
+void TControlConnection::Close()
+{
+	bClosed = true;
+	TxQueue.clear();
+	TxOffset = TxQueued = 0;
+}
+#pragma endregion
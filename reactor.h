@@ -0,0 +1,136 @@
+#pragma once
+/*
+	Control-connection reactor for aioenetd.
+
+	One edge-triggered epoll instance owns every Control socket; a small fixed number of I/O threads
+	service it.  Each socket is registered EPOLLONESHOT so exactly one I/O thread handles a given
+	connection at a time, drains it until EAGAIN, and then re-arms it.
+
+	Thread count (and wakeups) no longer grow with the number of connected Clients: an idle Client
+	costs an epoll registration, not a blocked receive-thread.
+
+	Received bytes are reassembled per connection: TCP is a byte stream, so one recv() may hold part of a
+	Message, or several pipelined Messages.  The reactor uses TMessageHeader.payload_size to cut complete
+	Messages out of the stream and hands each one, whole, to the TReceiveHandler supplied by aioenetd, which
+	passes it to the ParsePool to be parsed off the I/O thread, and from there to the ActionQueue.
+
+	Replies go out through a per-connection TxQueue drained by non-blocking writev().  The action thread only
+	appends serialized bytes and makes one non-blocking attempt; whatever the socket won't take is left queued and
+	finished by an I/O thread when EPOLLOUT fires, so a slow or stalled Client never blocks hardware execution.
+	Writes are watched on a dup() of the socket (TxFd), registered edge-triggered without EPOLLONESHOT, so the
+	action thread never needs to re-arm the receive registration another I/O thread may be holding.
+*/
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "eNET-types.h"
+#include "apci.h"
+
+#define REACTOR_IO_THREADS 2
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_MAX_IOV 64
+#define REACTOR_TX_LIMIT (4 * 1024 * 1024) // queued reply bytes beyond which a Client is considered stalled and dropped
+#define REACTOR_TX_POOL 8 // sent reply buffers kept per connection for reuse
+
+struct TActionQueueItemClass; // aioenetd.cpp
+
+class TControlConnection
+{
+public:
+	TControlConnection(int Socket, int TxFd) : Socket(Socket), TxFd(TxFd) {}
+	int Socket;
+	// dup() of Socket, registered with the reactor for EPOLLOUT only
+	int TxFd;
+	// bytes received but not yet part of a complete Message; only touched by the I/O thread holding the connection
+	TBytes RxBuffer;
+
+	// returns a buffer of size bytes, reusing one whose reply has already been sent when possible, so that
+	// serializing into it and handing it to Send() allocates nothing in steady state; safe from any thread
+	TBytes AcquireBuffer(size_t size);
+	// queue bytes for sending and push out as much as the socket will take without blocking; safe from any thread
+	// returns 0, or a negative errno if the connection is closed or has stalled past REACTOR_TX_LIMIT
+	int Send(TBytes bytes);
+	// writev() as much of TxQueue as the socket will take; caller holds TxLock
+	int Flush();
+	// marks the connection closed so later Send()s are discarded; caller holds TxLock
+	void Close();
+
+	std::mutex TxLock;
+	std::deque<TBytes> TxQueue;
+	size_t TxOffset = 0; // bytes of TxQueue.front() already sent
+	size_t TxQueued = 0; // unsent bytes across TxQueue
+	std::vector<TBytes> TxPool; // fully sent buffers, capacity intact, waiting for AcquireBuffer()
+	bool bClosed = false;
+
+	// admission control (see ControlReceived()): Messages queued or executing, the most there have been, and how many
+	// were turned away because the connection or the ActionQueue was full
+	std::atomic<int> InFlight{0};
+	std::atomic<int> PeakInFlight{0};
+	std::atomic<__u64> Rejected{0};
+	// action-thread scheduling weight, from Config.clientWeights; resolved when the connection is accepted (Add())
+	int Weight = 1;
+	// a Message of this connection's is executing on one of board i's ActionWorkers; that board's ActionThread only
+	bool bRunning[APCI_MAX_BOARDS] = {};
+	// the board (action pipeline) its Messages go to, picked by BRD_Select; guarded by ParsedLock
+	int Board = 0;
+
+	// Messages are numbered as they are framed, parsed in any order by the ParsePool, and handed to the ActionQueue in
+	// number order (see ControlReceived()).  RxSequence: the I/O thread holding the connection only
+	__u64 RxSequence = 0;
+	std::mutex ParsedLock;
+	__u64 NextToQueue = 0;								// guarded by ParsedLock
+	std::map<__u64, TActionQueueItemClass *> Parsed;	// parsed ahead of NextToQueue; nullptr if already answered
+};
+typedef std::shared_ptr<TControlConnection> PTControlConnection;
+
+// called by an I/O thread once per complete Message received on a Control connection; buffer holds exactly one Message
+typedef std::function<void(PTControlConnection conn, char buffer[], ssize_t bytesRead)> TReceiveHandler;
+
+class TReactor
+{
+public:
+	TReactor(TReceiveHandler OnReceive, int threadCount = REACTOR_IO_THREADS);
+	~TReactor();
+
+	// creates the epoll instance and spawns the I/O threads
+	int Start();
+	// wakes and joins the I/O threads; connections are closed
+	void Stop();
+	// hands a newly accepted (and already Hello'd) Control socket to the reactor, which owns it from then on; Weight
+	// is the connection's scheduling weight
+	int Add(int Socket, int Weight = 1);
+	// number of Control connections currently registered
+	size_t Count();
+
+protected:
+	static void *IoThread(void *arg);
+	void Run();
+	// drains conn until EAGAIN; returns false if the connection closed or failed
+	bool Readable(PTControlConnection conn);
+	// hands every complete Message in conn->RxBuffer + buffer[] to OnReceive, keeping any partial tail;
+	// returns false if the stream can no longer be framed
+	bool Deframe(PTControlConnection conn, char buffer[], ssize_t bytesRead);
+	// finishes a connection's pending replies once its socket is writable again; if that fails, shuts the socket
+	// down so the receive side sees the hang-up and Disconnect()s
+	void Writable(PTControlConnection conn);
+	int Rearm(PTControlConnection conn);
+	void Disconnect(PTControlConnection conn);
+
+	TReceiveHandler OnReceive;
+	int threadCount;
+	int epfd = -1;
+	int wakefd = -1;
+	volatile bool bStop = false;
+	std::vector<pthread_t> threads;
+
+	std::mutex m;
+	std::unordered_map<int, PTControlConnection> Connections;
+};
@@ -0,0 +1,153 @@
+#pragma once
+/*
+	Bounded, lock-free, single-producer/single-consumer ring of T slots.
+
+	The producer fills slots past its private write cursor and publishes any number of them with one release store of
+	head; the consumer reads published slots at its own pace (from any cursor it likes: readable(from)) and hands
+	slots back, again in bulk, with one release store of tail.  Slots are used in place -- the ring hands out
+	references, so T needn't be copyable.  Neither side takes a lock, or makes a syscall unless the other side is
+	asleep: the producer sleeps on a futex only while the ring is full, the consumer only while it is empty.
+
+	Positions are free-running 64-bit counters; slot(pos) is cells[pos % capacity], so capacity needn't be a power
+	of two.
+
+	Several readers can share the ring, each with its own cursor, as long as release() calls are serialized and only
+	hand back slots every reader is finished with (TAdcStreamSession does that under a lock).
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <ctime>
+#include <vector>
+
+#include "futex.h"
+
+template <class T>
+class SpscRing
+{
+public:
+	SpscRing(size_t capacity) : cells(capacity) {}
+
+	size_t capacity() { return cells.size(); }
+
+	T &slot(size_t pos) { return cells[pos % cells.size()]; }
+
+	// empties the ring and clears Stop(); only while neither side is using it
+	void Reset()
+	{
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		writePos = 0;
+		stop = false;
+	}
+
+	// wakes both sides and makes every wait return 0 until Reset()
+	void Stop()
+	{
+		stop = true;
+		wake(producerSleeping);
+		wake(consumerSleeping);
+	}
+
+	bool stopped() { return stop; }
+
+#pragma region producer
+	// position of the next slot to fill
+	size_t writePosition() { return writePos; }
+
+	// free slots right now
+	size_t writable() { return cells.size() - (writePos - tail.load(std::memory_order_acquire)); }
+
+	// free slots, waiting while there are none; 0 after Stop() or timeout (relative; nullptr waits indefinitely)
+	size_t waitWritable(const struct timespec *timeout = nullptr)
+	{
+		size_t count;
+		while (!(count = writable()) && !stop)
+			if (!sleepUnless(producerSleeping, [&] { return writable() != 0; }, timeout))
+				return stop ? 0 : writable(); // timed out
+		return stop ? 0 : count;
+	}
+
+	// makes the next count filled slots visible to the consumer
+	void publish(size_t count)
+	{
+		writePos += count;
+		head.store(writePos, std::memory_order_release);
+		wakeIfSleeping(consumerSleeping);
+	}
+#pragma endregion
+
+#pragma region consumer
+	// position after the last published slot
+	size_t published() { return head.load(std::memory_order_acquire); }
+
+	// published slots at or after position from
+	size_t readable(size_t from) { return head.load(std::memory_order_acquire) - from; }
+
+	// published slots at or after from, waiting while there are none; 0 after Stop() or timeout
+	size_t waitReadable(size_t from, const struct timespec *timeout = nullptr)
+	{
+		size_t count;
+		while (!(count = readable(from)) && !stop)
+			if (!sleepUnless(consumerSleeping, [&] { return readable(from) != 0; }, timeout))
+				return stop ? 0 : readable(from); // timed out
+		return stop ? 0 : count;
+	}
+
+	// hands the oldest count slots back to the producer
+	void release(size_t count)
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+		wakeIfSleeping(producerSleeping);
+	}
+
+	// makes every waiting reader re-check its own reasons to stop waiting
+	void WakeReaders() { wake(consumerSleeping); }
+#pragma endregion
+
+private:
+	// one side's sleepers.  There can be several readers, so they are counted rather than flagged -- one reader finding
+	// data ready mustn't clear another's claim to a wakeup -- and sleep on wakes, which every wake() bumps
+	struct TSleepers
+	{
+		std::atomic<int> count{0};
+		std::atomic<int> wakes{0}; // the futex word
+	};
+
+	// the protocol from MpscQueue: count in, fence, re-check, then sleep; the other side stores, fences, checks the
+	// count.  wakes is read before the re-check, so a wake() after it makes futexWait() return at once.
+	// false only on timeout.
+	template <class Ready>
+	bool sleepUnless(TSleepers &sleeping, Ready ready, const struct timespec *timeout)
+	{
+		sleeping.count.fetch_add(1, std::memory_order_relaxed);
+		int wakes = sleeping.wakes.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool bWoken = ready() || stop || (futexWait(sleeping.wakes, wakes, timeout) == 0) || (errno != ETIMEDOUT);
+		sleeping.count.fetch_sub(1, std::memory_order_relaxed);
+		return bWoken;
+	}
+
+	void wakeIfSleeping(TSleepers &sleeping)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping.count.load(std::memory_order_relaxed))
+			wake(sleeping);
+	}
+
+	// every sleeper on that side
+	void wake(TSleepers &sleeping)
+	{
+		sleeping.wakes.fetch_add(1, std::memory_order_relaxed);
+		futexWake(sleeping.wakes);
+	}
+
+	std::vector<T> cells;
+	alignas(64) std::atomic<size_t> head{0}; // published by the producer
+	size_t writePos = 0;						 // producer-only copy of head
+	alignas(64) std::atomic<size_t> tail{0}; // released by the consumer
+	TSleepers producerSleeping;
+	TSleepers consumerSleeping;
+	volatile bool stop = false;
+};
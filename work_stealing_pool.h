@@ -0,0 +1,178 @@
+#pragma once
+/*
+	Fixed pool of worker threads, each with its own deque of jobs, that steal from one another when idle.
+
+	trySubmit() puts a job on the deque its hint picks, so jobs with the same hint (aioenetd uses the Control socket)
+	tend to run on the same worker, with their data still in its cache.  A worker takes its own jobs oldest-first;
+	one with nothing to do takes the newest job from the first other deque that has one, so a burst on one hint
+	spreads over every core instead of queueing behind one worker.  Jobs may therefore finish in any order; a caller
+	that needs an order has to restore it (see ControlReceived()).
+
+	Each deque is a std::deque under its own mutex: a submitter and the owner only meet on the same deque, and a
+	thief only touches one deque at a time, so the locks are short and rarely contended.  Idle workers sleep on a
+	futex; trySubmit() makes a syscall only when one is asleep.
+
+	The pool is bounded: trySubmit() returns false rather than grow past capacity, and the caller runs the job
+	itself, which is what throttles a Client that sends faster than the pool can keep up.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
+
+#include "futex.h"
+
+template <class T>
+class WorkStealingPool
+{
+public:
+	typedef std::function<void(T)> THandler;
+
+	// Run is called once per submitted job, on a worker thread; capacity is shared evenly by the workers' deques
+	WorkStealingPool(THandler Run, size_t capacity = 1024) : Run(Run), capacity(capacity) {}
+	~WorkStealingPool() { Stop(); }
+
+	// spawns threadCount workers; 0 leaves the pool empty, so every trySubmit() fails
+	void Start(int threadCount)
+	{
+		if (threadCount <= 0)
+			return;
+		workers.clear();
+		for (int i = 0; i < threadCount; i++)
+			workers.emplace_back(new Worker);
+		perWorker = std::max<size_t>(capacity / threadCount, 1);
+		threads.resize(threadCount);
+		for (int i = 0; i < threadCount; i++)
+		{
+			auto *arg = new std::pair<WorkStealingPool *, int>(this, i);
+			pthread_create(&threads[i], NULL, WorkerThread, arg);
+		}
+	}
+
+	// runs every job already submitted, then joins the workers
+	void Stop()
+	{
+		if (threads.empty())
+			return;
+		stop = true;
+		epoch.fetch_add(1);
+		futexWake(epoch);
+		for (pthread_t thread : threads)
+			pthread_join(thread, NULL);
+		threads.clear();
+	}
+
+	int threadCount() { return threads.size(); }
+
+	// queues job for a worker; returns false, without blocking, if the pool is full or has no workers
+	bool trySubmit(T job, size_t hint)
+	{
+		if (threads.empty() || stop)
+			return false;
+		Worker &w = *workers[hint % workers.size()];
+		{
+			std::lock_guard<std::mutex> lock(w.m);
+			if (w.jobs.size() >= perWorker)
+				return false;
+			w.jobs.push_back(job);
+		}
+		// pairs with sleep(): either the worker's last look finds this job or we see it asleep
+		epoch.fetch_add(1);
+		if (sleepers.load())
+			futexWake(epoch, 1);
+		return true;
+	}
+
+private:
+	struct Worker
+	{
+		std::mutex m;
+		std::deque<T> jobs;
+	};
+
+	static void *WorkerThread(void *arg)
+	{
+		auto *self = (std::pair<WorkStealingPool *, int> *)arg;
+		WorkStealingPool *pool = self->first;
+		int index = self->second;
+		delete self;
+		pool->Work(index);
+		return nullptr;
+	}
+
+	void Work(int index)
+	{
+		for (;;)
+		{
+			T job;
+			if (take(index, job) || steal(index, job))
+			{
+				Run(job);
+				continue;
+			}
+			if (stop)
+				return;
+			sleep();
+		}
+	}
+
+	bool take(int index, T &job)
+	{
+		Worker &w = *workers[index];
+		std::lock_guard<std::mutex> lock(w.m);
+		if (w.jobs.empty())
+			return false;
+		job = w.jobs.front();
+		w.jobs.pop_front();
+		return true;
+	}
+
+	bool steal(int index, T &job)
+	{
+		for (size_t i = 1; i < workers.size(); i++)
+		{
+			Worker &victim = *workers[(index + i) % workers.size()];
+			std::lock_guard<std::mutex> lock(victim.m);
+			if (victim.jobs.empty())
+				continue;
+			job = victim.jobs.back();
+			victim.jobs.pop_back();
+			return true;
+		}
+		return false;
+	}
+
+	bool anyQueued()
+	{
+		for (auto &w : workers)
+		{
+			std::lock_guard<std::mutex> lock(w->m);
+			if (!w->jobs.empty())
+				return true;
+		}
+		return false;
+	}
+
+	void sleep()
+	{
+		sleepers.fetch_add(1);
+		int seen = epoch.load();
+		if (!anyQueued() && !stop)
+			futexWait(epoch, seen);
+		sleepers.fetch_sub(1);
+	}
+
+	THandler Run;
+	size_t capacity;
+	size_t perWorker = 1;
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<pthread_t> threads;
+	std::atomic<int> epoch{0};
+	std::atomic<int> sleepers{0};
+	volatile bool stop = false;
+};